@@ -0,0 +1,57 @@
+#ifndef OSMOSIS_ARCH_I386_CPU_H
+#define OSMOSIS_ARCH_I386_CPU_H
+
+#include <stdint.h>
+
+/*
+ * Small CPU primitives shared by diagnostics and benchmarks. The TSC is only
+ * used for relative cycle counts; it is never treated as wall-clock time.
+ */
+static inline uint64_t cpu_rdtsc(void) {
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Linear address of the last page fault. */
+static inline uint32_t cpu_read_cr2(void) {
+    uint32_t cr2;
+    __asm__ __volatile__("mov %%cr2, %0" : "=r"(cr2));
+    return cr2;
+}
+
+static inline void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                         : "a"(leaf), "c"(subleaf));
+}
+
+/* CPUID leaf 1 EDX feature bits. */
+#define CPUID_FEAT_PSE (1u << 3)
+#define CPUID_FEAT_PAE (1u << 6)
+#define CPUID_FEAT_PGE (1u << 13)
+
+static inline int cpu_has_feature(uint32_t edx_bit) {
+    uint32_t regs[4];
+    cpu_cpuid(0, 0, regs);
+    if (regs[0] < 1u) {
+        return 0;
+    }
+    cpu_cpuid(1, 0, regs);
+    return (regs[3] & edx_bit) != 0;
+}
+
+/* Divide a cycle total by a count without pulling in 64-bit libgcc helpers. */
+static inline uint32_t cpu_cycles_per(uint64_t cycles, uint32_t count) {
+    while (cycles >> 32) {
+        cycles >>= 1;
+        count >>= 1;
+    }
+    if (!count) {
+        return 0;
+    }
+    return (uint32_t)cycles / count;
+}
+
+#endif
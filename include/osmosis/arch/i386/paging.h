@@ -4,33 +4,91 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "osmosis/pmm.h"
+
 #define PAGE_SIZE 4096u
+#define PAGING_IDENTITY_MAP_LIMIT (64u * 1024u * 1024u) /* 64 MiB cap for early identity */
+
+/*
+ * Virtual layout: the identity window, then the per-process user half, then
+ * kernel-only regions. Page directory entries outside the user half are the
+ * kernel's and are shared by every address space.
+ */
+#define PAGING_USER_BASE  PAGING_IDENTITY_MAP_LIMIT
+#define PAGING_USER_LIMIT 0xC0000000u
+#define PAGING_HEAP_BASE  0xD0000000u
+#define PAGING_HEAP_LIMIT 0xE0000000u /* the heap may grow up to here */
+#define PAGING_VMALLOC_BASE  PAGING_HEAP_LIMIT
+#define PAGING_VMALLOC_LIMIT 0xE4000000u /* 64 MiB window for vmalloc */
 
 #define PAGE_PRESENT 0x001u
 #define PAGE_WRITE   0x002u
 #define PAGE_USER    0x004u
+#define PAGE_GLOBAL  0x100u /* survives CR3 reloads; kernel-only mappings */
+#define PAGE_COW     0x200u /* software bit: read-only until the shared frame is copied */
 
 struct boot_info;
 
+/*
+ * Address spaces are passed around as a pointer to their root table: the page
+ * directory in classic mode, or the four-entry PDPT when PAE is in use. The
+ * pointer holds the table's physical address, which need not be mapped; only
+ * paging.c looks inside, through its kmap window.
+ */
 struct paging_stats {
     int enabled;
+    int pae;
     uintptr_t page_directory_phys;
     uintptr_t identity_base;
     uintptr_t identity_limit;
-    uint32_t mapped_pages;
+    uint32_t mapped_pages;    /* 4 KiB PTEs */
+    uint32_t large_pages;     /* PDEs mapping a large page directly */
+    uint32_t large_page_size; /* 0 when large pages are unavailable */
     uint32_t page_table_count;
+    int global_pages;   /* CR4.PGE in use */
+    uint32_t cr3_loads; /* directory switches that wrote CR3 */
+    uint32_t cr3_skips; /* switches to the directory already loaded */
+    uint32_t tlb_single_flushes; /* invlpg after an unmap */
+    uint32_t tlb_full_flushes;   /* whole-TLB flushes from large unmaps */
+    uint32_t kmap_slots; /* temporary mapping slots for tables outside the identity map */
+    uint32_t kmap_peak;  /* most slots ever in use at once */
+    uint32_t cow_copies; /* write faults that copied a shared frame */
+    uint32_t cow_reuses; /* write faults that found the frame no longer shared */
+    uint32_t zero_fills; /* write faults that replaced the shared zero frame */
 };
 
+/* Supplies the frame for one page of a range; 0 stops the mapping. */
+typedef phys_addr_t (*paging_frame_fn)(uintptr_t virt, void *ctx);
+/* Receives each frame a range unmap removes. */
+typedef void (*paging_release_fn)(uintptr_t virt, phys_addr_t phys, void *ctx);
+
 void paging_init(const struct boot_info *boot);
 uint32_t *paging_current_directory(void);
+uint32_t *paging_kernel_directory(void);
+int paging_reserve_kernel_tables(uintptr_t virt, size_t size);
 void paging_switch_directory(uint32_t *dir);
 uint32_t *paging_create_address_space(void);
-int paging_map(uintptr_t virt, uintptr_t phys, uint32_t flags);
-int paging_map_in(uint32_t *directory, uintptr_t virt, uintptr_t phys, uint32_t flags);
+void paging_destroy_address_space(uint32_t *dir);
+size_t paging_unmap_user(uint32_t *dir);
+int paging_map(uintptr_t virt, phys_addr_t phys, uint32_t flags);
+int paging_map_in(uint32_t *directory, uintptr_t virt, phys_addr_t phys, uint32_t flags);
 int paging_unmap(uintptr_t virt);
-uintptr_t paging_resolve(uintptr_t virt);
-uintptr_t paging_resolve_in(uint32_t *directory, uintptr_t virt);
+size_t paging_map_range(uint32_t *directory, uintptr_t virt, size_t pages, uint32_t flags,
+                        paging_frame_fn frame_for, void *ctx);
+size_t paging_unmap_range(uint32_t *directory, uintptr_t virt, size_t pages,
+                          paging_release_fn release, void *ctx);
+size_t paging_protect_range(uint32_t *directory, uintptr_t virt, size_t pages, uint32_t flags);
+int paging_share_range(uint32_t *src, uint32_t *dst, uintptr_t virt, size_t pages,
+                       int copy_on_write);
+int paging_handle_fault(uintptr_t addr, uint32_t error);
+phys_addr_t paging_resolve(uintptr_t virt);
+phys_addr_t paging_resolve_in(uint32_t *directory, uintptr_t virt);
 int paging_range_has_flags(uintptr_t virt, size_t len, uint32_t flags);
+void paging_zero_frame(phys_addr_t phys);
+phys_addr_t paging_zero_page(void);
+void paging_copy_to_frame(phys_addr_t phys, uint32_t offset, const void *src, size_t len);
+int paging_pae_available(void);
+phys_addr_t paging_max_phys(void);
 int paging_enabled(void);
 struct paging_stats paging_get_stats(void);
 uintptr_t paging_identity_limit_value(void);
@@ -11,6 +11,13 @@ enum syscall_number {
     SYSCALL_EXIT  = OSMOSIS_SYS_EXIT,
     SYSCALL_GETPID = OSMOSIS_SYS_GETPID,
     SYSCALL_BRK = OSMOSIS_SYS_BRK,
+    SYSCALL_FORK = OSMOSIS_SYS_FORK,
+    SYSCALL_WAITPID = OSMOSIS_SYS_WAITPID,
+    SYSCALL_MMAP = OSMOSIS_SYS_MMAP,
+    SYSCALL_MUNMAP = OSMOSIS_SYS_MUNMAP,
+    SYSCALL_SHM_OPEN = OSMOSIS_SYS_SHM_OPEN,
+    SYSCALL_SHM_MAP = OSMOSIS_SYS_SHM_MAP,
+    SYSCALL_SHM_UNLINK = OSMOSIS_SYS_SHM_UNLINK,
 };
 
 void syscall_init(void);
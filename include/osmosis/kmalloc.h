@@ -4,19 +4,55 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define KMALLOC_CLASS_COUNT 13
+#define KMALLOC_MAX_SMALL 2048u /* larger requests take whole pages */
+#define KMEM_CACHE_LINE 64u     /* minimum alignment of kmem_cache objects */
+
 struct kmalloc_stats {
     uintptr_t heap_base;
     uintptr_t heap_limit;
     uintptr_t heap_top;
     uintptr_t mapped_bytes;
-    uintptr_t free_bytes;
+    uintptr_t cached_bytes; /* free pages still holding a frame */
+    uint32_t trimmed_pages; /* pages returned to the PMM so far */
+    uintptr_t free_bytes;  /* free page runs below heap_top */
+    uintptr_t large_bytes; /* pages held by page-granular allocations */
+    uintptr_t largest_free; /* longest free run, counting the space above heap_top */
     uint32_t total_allocs;
     uint32_t total_frees;
+    uint32_t bad_frees; /* kfree of a pointer the heap never returned */
+};
+
+struct kmalloc_class_stats {
+    uint32_t size;
+    uint32_t active; /* live objects */
+    uint32_t slabs;
+    uint32_t wasted; /* slab bytes not holding a live object */
+};
+
+struct kmem_cache;
+
+struct kmem_cache_stats {
+    const char *name;
+    uint32_t size;       /* object size as requested */
+    uint32_t stride;     /* bytes each object takes in a slab */
+    uint32_t per_slab;
+    uint32_t slabs;
+    uint32_t active;     /* live objects */
+    uint32_t allocs;     /* since boot */
+    uint32_t ctor_calls; /* objects constructed; allocs above this reused one */
 };
 
 void kmalloc_init(void);
 void *kmalloc(size_t size);
 void kfree(void *ptr);
 struct kmalloc_stats kmalloc_get_stats(void);
+int kmalloc_get_class_stats(uint32_t index, struct kmalloc_class_stats *out);
+
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, uint32_t align,
+                                     void (*ctor)(void *obj));
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+int kmem_cache_get_stats(uint32_t index, struct kmem_cache_stats *out);
 
 #endif
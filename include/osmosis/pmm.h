@@ -5,11 +5,121 @@
 
 #include "osmosis/boot.h"
 
+/* Physical addresses are 64-bit: with PAE, frames may sit above 4 GiB. */
+typedef uint64_t phys_addr_t;
+
+/* Buddy orders 0..PMM_MAX_ORDER: single 4 KiB frames up to 4 MiB blocks. */
+#define PMM_MAX_ORDER 10u
+#define PMM_ORDER_COUNT (PMM_MAX_ORDER + 1u)
+
+/*
+ * Physical zones, lowest first. Allocation flags pick the preferred zone; a
+ * request falls back to lower zones only, and never below their watermark.
+ *   default:            high -> identity -> dma
+ *   PMM_ALLOC_IDENTITY: identity -> dma   (frames the kernel dereferences)
+ *   PMM_ALLOC_DMA:      dma               (ISA DMA, below 16 MiB)
+ *   PMM_ALLOC_EXTENDED: extended -> high -> identity -> dma
+ * The extended zone holds frames above 4 GiB. They can only be reached
+ * through PAE page tables, so only callers that map the frame and never
+ * keep its address in a uintptr_t (user mappings) ask for them.
+ */
+enum pmm_zone_id {
+    PMM_ZONE_DMA = 0,
+    PMM_ZONE_IDENTITY,
+    PMM_ZONE_HIGH,
+    PMM_ZONE_EXTENDED,
+    PMM_ZONE_COUNT
+};
+
+#define PMM_ALLOC_IDENTITY 0x1u
+#define PMM_ALLOC_DMA      0x2u
+#define PMM_ALLOC_EXTENDED 0x8u
+#define PMM_ALLOC_ZERO     0x4u /* contents must be zero: served from the idle-zeroed pool */
+
+/* Page colors: frame number modulo a power of two, at most one per order-8 block. */
+#define PMM_MAX_COLORS 256u
+
+struct pmm_zone_stats {
+    const char *name;
+    phys_addr_t base;
+    phys_addr_t limit;
+    uint32_t present_frames;
+    uint32_t free_frames;
+    uint32_t watermark_min;
+    uint32_t watermark_low;
+    uint32_t cached_frames; /* single frames parked in the zone's magazine */
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+    uint32_t zeroed_frames; /* pre-zeroed frames waiting in the zone's pool */
+    uint32_t zero_hits;
+    uint32_t zero_misses;
+};
+
+struct pmm_stats {
+    uint32_t total_frames;
+    uint32_t free_frames;
+    uint32_t order_free[PMM_ORDER_COUNT]; /* free blocks of 2^order frames */
+    uint32_t colors;       /* 0 when page coloring is off */
+    uint32_t color_hits;   /* colored requests served with the wanted color */
+    uint32_t color_misses; /* colored requests that fell back to any frame */
+    struct pmm_zone_stats zones[PMM_ZONE_COUNT];
+};
+
+/*
+ * Per-frame descriptor, one per physical frame, allocated at pmm_init(). A
+ * frame handed out by the allocator starts with refcount 1; sharing it takes
+ * another reference with pmm_page_get(), and pmm_free_frame()/pmm_free_frames()
+ * drop one, releasing the frame only when the count reaches zero. Blocks of
+ * more than one frame are tracked through their first frame.
+ */
+#define PMM_PAGE_ZEROED 0x01u /* contents known to be all zero */
+#define PMM_PAGE_TABLE  0x02u /* holds a page table or page directory */
+#define PMM_PAGE_PINNED 0x04u /* never freed: low memory, kernel image, metadata */
+
+struct page {
+    uint16_t refcount;
+    uint8_t flags;
+    uint8_t order; /* block order while allocated */
+    union {
+        uint32_t owner; /* owner cookie while allocated */
+        uint32_t next;  /* list link while queued by a subsystem */
+    };
+};
+
+_Static_assert(sizeof(struct page) <= 16, "struct page must stay compact");
+
 void pmm_init(const struct boot_info *boot);
 uintptr_t pmm_alloc_frame(void);
-uintptr_t pmm_alloc_frame_below(uintptr_t max_addr);
-void pmm_free_frame(uintptr_t addr);
+void pmm_free_frame(phys_addr_t addr);
+
+/*
+ * Physically contiguous, naturally aligned blocks of 2^order frames. The
+ * caller frees with the same order it allocated; 0 means no block available.
+ * Without PMM_ALLOC_EXTENDED the result always fits in a uintptr_t.
+ */
+uintptr_t pmm_alloc_frames(uint32_t order);
+phys_addr_t pmm_alloc_frames_flags(uint32_t order, uint32_t flags);
+void pmm_free_frames(phys_addr_t addr, uint32_t order);
+
+/*
+ * Page coloring (off by default). pmm_alloc_frame_color() returns a single
+ * frame whose color follows `virt`, falling back to any frame when none of
+ * that color is free.
+ */
+phys_addr_t pmm_alloc_frame_color(uintptr_t virt, uint32_t flags);
+uint32_t pmm_set_colors(uint32_t colors);
+uint32_t pmm_colors(void);
+uint32_t pmm_cache_colors(void);
+
+void pmm_idle_work(void);
+
+struct page *pmm_page(phys_addr_t addr);
+void pmm_page_get(phys_addr_t addr);
+
 uint32_t pmm_total_frames(void);
-uint32_t pmm_free_frames(void);
+uint32_t pmm_free_frame_count(void);
+struct pmm_stats pmm_get_stats(void);
+void pmm_benchmark(void);
+void pmm_color_benchmark(void);
 
 #endif
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "osmosis/arch/i386/isr.h"
+#include "osmosis/vma.h"
 
 enum process_state {
     PROCESS_UNUSED = 0,
@@ -15,10 +16,10 @@ enum process_state {
 
 struct process_image {
     uintptr_t entry;
-    uintptr_t lowest;
-    uintptr_t highest;
-    uintptr_t stack_base;
     uintptr_t stack_top;
+    uintptr_t brk_start; /* the heap runs from here (page-aligned) ... */
+    uintptr_t brk;       /* ... to the current break */
+    struct vma_map vmas; /* every valid user address; pages are populated on first touch */
 };
 
 struct process {
@@ -31,6 +32,21 @@ struct process {
     int waiting_for;
     uint32_t *page_directory;
     char name[32];
+    struct process *next; /* in the process list */
+};
+
+enum process_fault {
+    PROCESS_FAULT_UNRESOLVED = 0,
+    PROCESS_FAULT_RESOLVED,
+    PROCESS_FAULT_KILL /* the current process must die, e.g. on a stack overflow */
+};
+
+struct process_stats {
+    uint32_t context_switches;    /* scheduler picked a different process */
+    uint32_t lazy_kernel_returns; /* returns to kernel work without a CR3 switch */
+    uint32_t demand_faults;       /* file or anonymous pages populated on first touch */
+    uint32_t stack_growths;       /* stack pages populated on first touch */
+    uint32_t zero_maps;           /* anonymous read faults served by the shared zero frame */
 };
 
 void process_init(void);
@@ -47,10 +63,16 @@ int process_sys_fork(struct isr_frame *frame);
 int process_sys_execve(struct isr_frame *frame, const char *path, const char *const *argv);
 int process_sys_waitpid(struct isr_frame *frame, int pid);
 void process_sys_exit(struct isr_frame *frame, int code);
+uintptr_t process_sys_brk(uintptr_t requested);
+uintptr_t process_sys_mmap(uintptr_t hint, uint32_t len, uint32_t prot, uint32_t flags);
+int process_sys_munmap(uintptr_t addr, uint32_t len);
+uintptr_t process_sys_shm_map(int id, uint32_t prot);
 
 int process_user_pointer_ok(uintptr_t ptr, uint32_t len);
+enum process_fault process_page_fault(uintptr_t addr, uint32_t error);
 
 /* Debug helpers */
 void process_list(void);
+struct process_stats process_get_stats(void);
 
 #endif
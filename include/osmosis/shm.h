@@ -0,0 +1,22 @@
+#ifndef OSMOSIS_SHM_H
+#define OSMOSIS_SHM_H
+
+#include <stdint.h>
+
+#define SHM_MAX_SEGMENTS 8
+#define SHM_MAX_PAGES 256 /* 1 MiB per segment */
+
+struct shm_stats {
+    uint32_t segments; /* named segments alive */
+    uint32_t pages;    /* frames those segments hold */
+    uint32_t attaches; /* successful maps since boot */
+};
+
+int shm_open(uint32_t key, uint32_t size);
+uint32_t shm_pages(int id);
+int shm_map_into(int id, uint32_t *directory, uintptr_t virt, uint32_t flags);
+int shm_unlink(int id);
+void shm_list(void);
+struct shm_stats shm_get_stats(void);
+
+#endif
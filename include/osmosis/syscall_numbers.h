@@ -5,5 +5,20 @@
 #define OSMOSIS_SYS_EXIT  1
 #define OSMOSIS_SYS_GETPID 2
 #define OSMOSIS_SYS_BRK   3
+#define OSMOSIS_SYS_FORK  4
+#define OSMOSIS_SYS_WAITPID 5
+#define OSMOSIS_SYS_MMAP  6
+#define OSMOSIS_SYS_MUNMAP 7
+#define OSMOSIS_SYS_SHM_OPEN   8
+#define OSMOSIS_SYS_SHM_MAP    9
+#define OSMOSIS_SYS_SHM_UNLINK 10
+
+/* mmap protection and flags; only private anonymous mappings exist. */
+#define OSMOSIS_PROT_NONE  0x0
+#define OSMOSIS_PROT_READ  0x1
+#define OSMOSIS_PROT_WRITE 0x2
+#define OSMOSIS_PROT_EXEC  0x4
+#define OSMOSIS_MAP_PRIVATE   0x02
+#define OSMOSIS_MAP_ANONYMOUS 0x20
 
 #endif
@@ -7,6 +7,7 @@ struct vfs_node {
     const char *path;
     const uint8_t *data;
     uint32_t size;
+    struct vfs_node *next;
 };
 
 void vfs_init(const uint8_t *initramfs, uint32_t size);
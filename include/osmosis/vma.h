@@ -0,0 +1,63 @@
+#ifndef OSMOSIS_VMA_H
+#define OSMOSIS_VMA_H
+
+#include <stdint.h>
+
+#define VMA_INITIAL_CAPACITY 8 /* the area array starts here and doubles as needed */
+#define VMA_FILE_RANGES 2 /* a page shared by two ELF segments carries both */
+
+enum vma_kind {
+    VMA_ANON = 0, /* zero-filled on first touch */
+    VMA_FILE,     /* populated from an executable image */
+    VMA_STACK,    /* zero-filled; the page below it is a guard */
+    VMA_SHARED    /* shared-memory frames, mapped whole when attached */
+};
+
+/* Bytes [vaddr, vaddr + size) of a file area come from its file at `offset`. */
+struct vma_file_range {
+    uintptr_t vaddr;
+    uint32_t offset;
+    uint32_t size;
+};
+
+/*
+ * A user virtual memory area: the page-aligned range [start, end) with one
+ * protection and one backing. A file area takes the bytes of its ranges from
+ * `file` and zero-fills everything else; only a page shared by two segments
+ * has more than one range. Ranges are absolute, so splitting an area leaves
+ * them unchanged.
+ */
+struct vma {
+    uintptr_t start;
+    uintptr_t end;
+    uint32_t prot; /* PAGE_USER, plus PAGE_WRITE for writable areas */
+    enum vma_kind kind;
+    const uint8_t *file;
+    uint32_t file_ranges; /* entries of `files` in use */
+    struct vma_file_range files[VMA_FILE_RANGES];
+};
+
+/*
+ * The areas of one address space, sorted by address and never overlapping,
+ * in a kmalloc'd array that grows on demand. Lookups are binary searches;
+ * neighbours that could be one area are merged on insert, so most ranges
+ * resolve in a single lookup.
+ */
+struct vma_map {
+    uint32_t count;
+    uint32_t capacity;
+    struct vma *areas;
+};
+
+void vma_map_init(struct vma_map *map);
+int vma_map_clone(struct vma_map *dst, const struct vma_map *src);
+void vma_map_destroy(struct vma_map *map);
+struct vma *vma_find(struct vma_map *map, uintptr_t addr);
+int vma_insert(struct vma_map *map, const struct vma *area);
+int vma_split(struct vma_map *map, uintptr_t addr);
+int vma_remove(struct vma_map *map, uintptr_t start, uintptr_t end);
+uintptr_t vma_find_gap(const struct vma_map *map, uintptr_t low, uintptr_t high, uint32_t size);
+int vma_range_ok(const struct vma_map *map, uintptr_t addr, uint32_t len, uint32_t prot);
+const char *vma_kind_name(enum vma_kind kind);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef OSMOSIS_VMALLOC_H
+#define OSMOSIS_VMALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VMALLOC_MAX_AREAS 32
+
+struct vmalloc_stats {
+    uint32_t areas;
+    uint32_t reserved_pages; /* pages of address space handed out */
+    uint32_t mapped_pages;   /* pages of those backed by a frame */
+    uint32_t lazy_faults;    /* pages populated by a fault */
+    uint32_t failures;       /* allocations or faults that ran out of space or frames */
+};
+
+void vmalloc_init(void);
+void *vmalloc(size_t size);
+void *vmalloc_lazy(size_t size);
+void vfree(void *addr);
+int vmalloc_fault(uintptr_t addr, uint32_t error);
+void vmalloc_list(void);
+struct vmalloc_stats vmalloc_get_stats(void);
+
+#endif
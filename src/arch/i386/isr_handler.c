@@ -1,6 +1,10 @@
+#include "osmosis/arch/i386/cpu.h"
 #include "osmosis/arch/i386/isr.h"
 #include "osmosis/kprintf.h"
 #include "osmosis/panic.h"
+#include "osmosis/process.h"
+#include "osmosis/userland.h"
+#include "osmosis/vmalloc.h"
 
 static const char *exception_names[32] = {
     "Divide-by-zero", "Debug", "Non-maskable interrupt", "Breakpoint", "Overflow",
@@ -12,13 +16,54 @@ static const char *exception_names[32] = {
     "Reserved", "Reserved", "Security exception", "Reserved"
 };
 
+#define PAGE_FAULT_VECTOR 14u
+#define PF_USER 0x4u               /* page-fault error code: taken in user mode */
+#define FAULT_EXIT_STATUS (-14)    /* EFAULT */
+
+/*
+ * A user-mode fault nobody could resolve ends the task that took it, not the
+ * kernel: exit the current process and run the next one, or return the boot
+ * demo to its launcher.
+ */
+static void kill_faulting_task(struct isr_frame *frame, uintptr_t addr) {
+    kprintf("pid %u: page fault at 0x%x (eip 0x%x, error 0x%x), killed\n",
+            process_current() ? process_current_pid() : userland_current_pid(), (uint32_t)addr,
+            frame->eip, frame->err_code);
+    if (!process_current()) {
+        userland_exit_from_syscall(frame, (uint32_t)FAULT_EXIT_STATUS);
+        return;
+    }
+    process_sys_exit(frame, FAULT_EXIT_STATUS);
+    if (process_schedule(frame) < 0) {
+        process_prepare_kernel_return(frame);
+    }
+}
+
 void isr_handler(struct isr_frame *frame) {
+    if (frame->int_no == PAGE_FAULT_VECTOR) {
+        uintptr_t addr = cpu_read_cr2();
+        if (vmalloc_fault(addr, frame->err_code)) {
+            return;
+        }
+        enum process_fault result = process_page_fault(addr, frame->err_code);
+        if (result == PROCESS_FAULT_RESOLVED) {
+            return;
+        }
+        /* A guard-page hit is the process's fault even when the kernel took it. */
+        if (result == PROCESS_FAULT_KILL || (frame->err_code & PF_USER)) {
+            kill_faulting_task(frame, addr);
+            return;
+        }
+    }
     if (frame->int_no < 32) {
         const char *name = exception_names[frame->int_no];
         kprintf("\n*** CPU EXCEPTION ***\n");
         kprintf("Vector : %d (%s)\n", frame->int_no, name);
         kprintf("Error  : 0x%x\n", frame->err_code);
         kprintf("EIP    : 0x%x\n", frame->eip);
+        if (frame->int_no == PAGE_FAULT_VECTOR) {
+            kprintf("CR2    : 0x%x\n", cpu_read_cr2());
+        }
         kprintf("CS:EFLAGS: 0x%x:0x%x\n", frame->cs, frame->eflags);
         panic("Unhandled CPU exception");
     }
@@ -1,6 +1,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "osmosis/arch/i386/cpu.h"
+#include "osmosis/arch/i386/irq.h"
 #include "osmosis/arch/i386/paging.h"
 #include "osmosis/boot.h"
 #include "osmosis/kprintf.h"
@@ -9,29 +11,85 @@
 
 #define PAGE_TABLE_ENTRIES 1024u
 #define PAGE_DIRECTORY_ENTRIES 1024u
+#define PAE_TABLE_ENTRIES 512u
+#define PAE_PDPT_ENTRIES 4u
 #define PAGE_ALIGN_MASK (~(PAGE_SIZE - 1u))
-#define IDENTITY_MAP_LIMIT (64u * 1024u * 1024u) /* 64 MiB cap for early identity */
-
-struct page_table {
-    uint32_t entries[PAGE_TABLE_ENTRIES];
-} __attribute__((aligned(PAGE_SIZE)));
+#define PAE_ADDR_MASK 0x000FFFFFFFFFF000ull
+#define PAGE_FLAGS_MASK 0xFFFu
+#define PAGE_LARGE 0x080u /* PDE maps a 4 MiB (2 MiB with PAE) page directly */
+#define CR0_WP 0x00010000u
+#define CR0_PG 0x80000000u
+#define CR4_PSE 0x10u
+#define CR4_PAE 0x20u
+#define CR4_PGE 0x80u
+#define KMAP_BASE 0xFFFF0000u /* temporary mappings for frames outside the identity map */
+#define KMAP_SLOTS 16u
 
+/*
+ * Two table formats share this file. Classic paging uses a 1024-entry page
+ * directory of 32-bit entries, each pointing at a 1024-entry page table. PAE
+ * adds a four-entry PDPT on top and halves every table to 512 64-bit entries,
+ * which widens physical addresses to 36 bits and beyond. The walkers below
+ * read and write entries as 64-bit values either way; only entry_get(),
+ * entry_set() and the index helpers know the width.
+ *
+ * Tables are only ever touched through kmap(), which hands back the identity
+ * mapping when the frame has one and borrows a slot of the kmap window
+ * otherwise. Table and directory frames can therefore come from anywhere in
+ * RAM; only the classic-mode tables and the PAE PDPT (loaded into a 32-bit
+ * CR3) must stay below 4 GiB. The `uint32_t *` address-space handles are
+ * physical addresses and are never dereferenced outside this file.
+ */
 static uint32_t kernel_page_directory[PAGE_DIRECTORY_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t kernel_pdpt[PAE_PDPT_ENTRIES] __attribute__((aligned(32)));
+static uint32_t *kernel_root = kernel_page_directory;
 static uint32_t *current_directory = kernel_page_directory;
 static uintptr_t identity_limit = 0;
 static uint32_t mapped_pages = 0;
+static uint32_t large_pages = 0;
 static uint32_t allocated_tables = 0;
 static int paging_on = 0;
+static int pae_on = 0;
+static int large_on = 0;
+static int global_on = 0;
+static uint32_t kernel_flags = PAGE_WRITE; /* identity map and kmap window */
+static uint32_t cr3_loads = 0;
+static uint32_t cr3_skips = 0;
+static uint32_t tlb_single_flushes = 0;
+static uint32_t tlb_full_flushes = 0;
+static uint32_t cow_copies = 0;
+static uint32_t cow_reuses = 0;
+static uint32_t zero_fills = 0;
+static phys_addr_t zero_frame = 0;
 
-extern char _kernel_end[];
+/*
+ * Invalidations collected while a range is unmapped, flushed once at the end:
+ * one invlpg per page for small batches, a full flush past the threshold,
+ * where reloading the TLB is cheaper than invalidating entry by entry.
+ */
+#define TLB_GATHER_MAX 32u
 
-static inline uint32_t pd_index(uintptr_t addr) {
-    return (uint32_t)((addr >> 22) & 0x3FFu);
-}
+struct tlb_gather {
+    uint32_t *directory;
+    uintptr_t addrs[TLB_GATHER_MAX];
+    uint32_t count;
+    int overflow; /* more than TLB_GATHER_MAX pages: flush everything */
+    int global;   /* a global entry was removed; a CR3 reload keeps those */
+    int shared;   /* a kernel-half entry was removed; every address space sees its table */
+};
 
-static inline uint32_t pt_index(uintptr_t addr) {
-    return (uint32_t)((addr >> 12) & 0x3FFu);
-}
+/*
+ * The kmap window: the last KMAP_SLOTS pages of the address space, backed by
+ * one page table in .bss. Its PDE is installed before any address space is
+ * created, so every address space shares the same slots. Entries use the
+ * same format as every other table; only the low indices of a PAE table are
+ * wasted.
+ */
+static uint32_t kmap_table[PAGE_TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t kmap_used = 0; /* bitmap of busy slots */
+static uint32_t kmap_peak = 0;
+
+extern char _kernel_end[];
 
 static inline void invlpg(uintptr_t addr) {
     __asm__ __volatile__("invlpg (%0)" :: "r"(addr) : "memory");
@@ -45,86 +103,259 @@ static inline uintptr_t align_down(uintptr_t value, uintptr_t align) {
     return value & ~(align - 1u);
 }
 
+static inline uint64_t entry_get(const void *table, uint32_t index) {
+    if (pae_on) {
+        return ((const volatile uint64_t *)table)[index];
+    }
+    return ((const volatile uint32_t *)table)[index];
+}
+
+/*
+ * A PAE entry is stored as two 32-bit writes. The low half, which holds the
+ * present bit, is cleared first and written last so the MMU never sees a
+ * present entry with a stale upper address.
+ */
+static inline void entry_set(void *table, uint32_t index, uint64_t value) {
+    if (!pae_on) {
+        ((volatile uint32_t *)table)[index] = (uint32_t)value;
+        return;
+    }
+    volatile uint32_t *half = (volatile uint32_t *)&((uint64_t *)table)[index];
+    half[0] = 0;
+    half[1] = (uint32_t)(value >> 32);
+    half[0] = (uint32_t)value;
+}
+
+static inline phys_addr_t entry_addr(uint64_t entry) {
+    return pae_on ? (entry & PAE_ADDR_MASK) : (entry & PAGE_ALIGN_MASK);
+}
+
+static inline uintptr_t large_page_size(void) {
+    return pae_on ? 0x200000u : 0x400000u;
+}
+
+static inline uint32_t pte_index(uintptr_t virt) {
+    return pae_on ? (uint32_t)((virt >> 12) & 0x1FFu) : (uint32_t)((virt >> 12) & 0x3FFu);
+}
+
+/*
+ * Make the frame holding `phys` addressable and return a pointer to `phys`.
+ * Before paging and inside the identity map that is the address itself;
+ * anything else takes a kmap slot until kunmap(). Slots are taken with
+ * interrupts off, so a handler may nest its own kmap() inside ours.
+ */
+static void *kmap(phys_addr_t phys) {
+    if (!paging_on || phys < identity_limit) {
+        if (phys >> 32) {
+            panic("Paging: cannot reach a frame above 4 GiB before paging is on");
+        }
+        return (void *)(uintptr_t)phys;
+    }
+
+    uint32_t irq_flags = irq_save();
+    uint32_t slot = 0;
+    while (slot < KMAP_SLOTS && (kmap_used & (1u << slot))) {
+        slot++;
+    }
+    if (slot == KMAP_SLOTS) {
+        panic("Paging: out of kmap slots");
+    }
+    kmap_used |= 1u << slot;
+    if (slot + 1u > kmap_peak) {
+        kmap_peak = slot + 1u;
+    }
+    irq_restore(irq_flags);
+
+    uintptr_t virt = KMAP_BASE + slot * PAGE_SIZE;
+    /* kunmap() invalidated the slot, so no stale entry can be cached. */
+    entry_set(kmap_table, pte_index(virt),
+              (phys & ~(phys_addr_t)(PAGE_SIZE - 1u)) | kernel_flags | PAGE_PRESENT);
+    return (void *)(virt | (uintptr_t)(phys & (PAGE_SIZE - 1u)));
+}
+
+static void kunmap(void *ptr) {
+    uintptr_t virt = (uintptr_t)ptr & PAGE_ALIGN_MASK;
+    if (virt < KMAP_BASE) {
+        return; /* identity-mapped: nothing was borrowed */
+    }
+
+    entry_set(kmap_table, pte_index(virt), 0);
+    invlpg(virt);
+
+    uint32_t irq_flags = irq_save();
+    kmap_used &= ~(1u << ((virt - KMAP_BASE) / PAGE_SIZE));
+    irq_restore(irq_flags);
+}
+
+/*
+ * Map the page directory that covers `virt` and return it, with the PDE
+ * index inside it in `index`. Release it with kunmap().
+ */
+static void *map_directory(uint32_t *root, uintptr_t virt, uint32_t *index) {
+    if (!pae_on) {
+        *index = (uint32_t)((virt >> 22) & 0x3FFu);
+        return kmap((uintptr_t)root);
+    }
+    *index = (uint32_t)((virt >> 21) & 0x1FFu);
+    const uint64_t *pdpt = kmap((uintptr_t)root);
+    phys_addr_t directory = entry_addr(pdpt[virt >> 30]);
+    kunmap((void *)pdpt);
+    return kmap(directory);
+}
+
+/*
+ * Map the page table holding the PTE for `virt`, or return NULL if the PDE is
+ * absent or maps a large page itself; `pde_out` tells the two apart. A table
+ * that is returned must be released with kunmap().
+ */
+static void *table_of(uint32_t *root, uintptr_t virt, uint64_t *pde_out) {
+    uint32_t index;
+    void *directory = map_directory(root, virt, &index);
+    uint64_t pde = entry_get(directory, index);
+    kunmap(directory);
+    if (pde_out) {
+        *pde_out = pde;
+    }
+    if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) {
+        return NULL;
+    }
+    return kmap(entry_addr(pde));
+}
+
 static uintptr_t highest_usable(const struct boot_info *boot) {
     if (!boot) {
         return 0;
     }
-    uintptr_t max_addr = 0;
+    uint64_t max_addr = 0;
     for (uint32_t i = 0; i < boot->region_count; i++) {
         const struct boot_memory_region *region = &boot->regions[i];
         if (region->type != BOOT_MEMORY_USABLE) {
             continue;
         }
-        uintptr_t end = (uintptr_t)(region->base + region->length);
+        uint64_t end = region->base + region->length;
         if (end > max_addr) {
             max_addr = end;
         }
     }
-    return max_addr;
+    /* Only the identity map cares, and that never reaches past 4 GiB. */
+    return max_addr > 0xFFFFF000ull ? 0xFFFFF000u : (uintptr_t)max_addr;
 }
 
-static struct page_table *alloc_page_table(void) {
-    uintptr_t frame = pmm_alloc_frame_below(identity_limit);
-    if (!frame) {
-        frame = pmm_alloc_frame();
-        if (!frame) {
-            return NULL;
-        }
+static inline void zero_page(void *dest) {
+    uint32_t count = PAGE_SIZE / sizeof(uint32_t);
+    __asm__ __volatile__("rep stosl"
+                         : "+D"(dest), "+c"(count)
+                         : "a"(0u)
+                         : "memory");
+}
+
+/*
+ * Until paging is on, every table is written through its physical address,
+ * so early tables come from the identity zone. Afterwards kmap() reaches any
+ * frame: PAE tables may sit above 4 GiB, classic ones anywhere below it.
+ */
+static uint32_t table_alloc_flags(void) {
+    if (!paging_on) {
+        return PMM_ALLOC_IDENTITY;
     }
+    return pae_on ? PMM_ALLOC_EXTENDED : 0;
+}
 
-    struct page_table *table = (struct page_table *)(frame);
-    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
-        table->entries[i] = 0;
+static phys_addr_t alloc_page_table(void) {
+    phys_addr_t frame = pmm_alloc_frames_flags(0, table_alloc_flags() | PMM_ALLOC_ZERO);
+    if (!frame) {
+        return 0;
     }
+    pmm_page(frame)->flags |= PMM_PAGE_TABLE;
+
     allocated_tables++;
-    return table;
+    return frame;
 }
 
-static struct page_table *get_or_create_table(uint32_t *directory, uintptr_t virt, uint32_t flags) {
-    uint32_t index = pd_index(virt);
-    uint32_t entry = directory[index];
+/* Like table_of(), but creates a missing table. Release it with kunmap(). */
+static void *get_or_create_table(uint32_t *root, uintptr_t virt, uint32_t flags) {
+    uint32_t index;
+    void *directory = map_directory(root, virt, &index);
+    uint64_t entry = entry_get(directory, index);
 
     if (entry & PAGE_PRESENT) {
-        uintptr_t table_addr = entry & PAGE_ALIGN_MASK;
-        return (struct page_table *)table_addr;
+        kunmap(directory);
+        if (entry & PAGE_LARGE) {
+            return NULL; /* already covered by a large page */
+        }
+        return kmap(entry_addr(entry));
     }
 
-    struct page_table *table = alloc_page_table();
+    phys_addr_t table = alloc_page_table();
     if (!table) {
+        kunmap(directory);
         return NULL;
     }
 
-    directory[index] = ((uintptr_t)table & PAGE_ALIGN_MASK) | (flags & 0xFFFu) | PAGE_PRESENT;
-    return table;
+    /* The global bit means nothing on a PDE that points at a table. */
+    entry_set(directory, index, table | (flags & PAGE_FLAGS_MASK & ~PAGE_GLOBAL) | PAGE_PRESENT);
+    kunmap(directory);
+    return kmap(table);
 }
 
-static int map_single(uint32_t *directory, uintptr_t virt, uintptr_t phys, uint32_t flags) {
+static int map_single(uint32_t *root, uintptr_t virt, phys_addr_t phys, uint32_t flags) {
     if ((virt & (PAGE_SIZE - 1u)) || (phys & (PAGE_SIZE - 1u))) {
         return 0;
     }
+    if (!pae_on && (phys >> 32)) {
+        return 0; /* classic entries hold 32-bit frame addresses only */
+    }
 
-    struct page_table *table = get_or_create_table(directory, virt, flags | PAGE_WRITE);
+    void *table = get_or_create_table(root, virt, flags | PAGE_WRITE);
     if (!table) {
         return 0;
     }
 
-    uint32_t t_index = pt_index(virt);
-    if (table->entries[t_index] & PAGE_PRESENT) {
+    uint32_t t_index = pte_index(virt);
+    if (entry_get(table, t_index) & PAGE_PRESENT) {
+        kunmap(table);
         return 0;
     }
 
-    table->entries[t_index] = (uint32_t)(phys & PAGE_ALIGN_MASK) | (flags & 0xFFFu) | PAGE_PRESENT;
+    /* The entry was not present, so the TLB holds nothing to invalidate. */
+    entry_set(table, t_index, phys | (flags & PAGE_FLAGS_MASK) | PAGE_PRESENT);
+    kunmap(table);
     mapped_pages++;
-    invlpg(virt);
     return 1;
 }
 
+static int map_large(uint32_t *root, uintptr_t virt, phys_addr_t phys, uint32_t flags) {
+    uint32_t index;
+    void *directory = map_directory(root, virt, &index);
+    if (entry_get(directory, index) & PAGE_PRESENT) {
+        kunmap(directory);
+        return 0;
+    }
+    entry_set(directory, index, phys | (flags & PAGE_FLAGS_MASK) | PAGE_LARGE | PAGE_PRESENT);
+    kunmap(directory);
+    large_pages++;
+    return 1;
+}
+
+/*
+ * Map the identity window with large pages wherever a whole aligned large
+ * page fits, and with 4 KiB pages only at the unaligned edges. Large pages
+ * need no page tables and take one TLB entry per 4 MiB (2 MiB with PAE).
+ */
 static void identity_map_range(uintptr_t start, uintptr_t end) {
     uintptr_t aligned_start = start & PAGE_ALIGN_MASK;
     uintptr_t aligned_end = align_up(end, PAGE_SIZE);
+    uintptr_t large = large_page_size();
 
-    for (uintptr_t addr = aligned_start; addr < aligned_end; addr += PAGE_SIZE) {
-        (void)map_single(kernel_page_directory, addr, addr, PAGE_WRITE);
+    uintptr_t addr = aligned_start;
+    while (addr < aligned_end) {
+        if (large_on && !(addr & (large - 1u)) && aligned_end - addr >= large) {
+            (void)map_large(kernel_root, addr, addr, kernel_flags);
+            addr += large;
+        } else {
+            (void)map_single(kernel_root, addr, addr, kernel_flags);
+            addr += PAGE_SIZE;
+        }
     }
 }
 
@@ -132,17 +363,116 @@ static void load_page_directory(uintptr_t phys) {
     __asm__ __volatile__("mov %0, %%cr3" :: "r"(phys) : "memory");
 }
 
+static uint32_t read_cr4(void) {
+    uint32_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static void write_cr4(uint32_t cr4) {
+    __asm__ __volatile__("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+static void tlb_gather_init(struct tlb_gather *gather, uint32_t *directory) {
+    gather->directory = directory;
+    gather->count = 0;
+    gather->overflow = 0;
+    gather->global = 0;
+    gather->shared = 0;
+}
+
+static void tlb_gather_add(struct tlb_gather *gather, uintptr_t virt, uint64_t old_entry) {
+    if (old_entry & PAGE_GLOBAL) {
+        gather->global = 1;
+    }
+    if (virt >= PAGING_USER_LIMIT) {
+        gather->shared = 1;
+    }
+    if (gather->count < TLB_GATHER_MAX) {
+        gather->addrs[gather->count++] = virt;
+    } else {
+        gather->overflow = 1;
+    }
+}
+
+static void tlb_gather_flush(struct tlb_gather *gather) {
+    /*
+     * A directory that is not loaded has no TLB entries, except global ones
+     * and kernel pages, whose tables the loaded directory shares.
+     */
+    if (!paging_on ||
+        (gather->directory != current_directory && !gather->global && !gather->shared)) {
+        gather->count = 0;
+        return;
+    }
+
+    if (!gather->overflow) {
+        for (uint32_t i = 0; i < gather->count; i++) {
+            invlpg(gather->addrs[i]);
+        }
+        tlb_single_flushes += gather->count;
+    } else if (gather->global && global_on) {
+        uint32_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE); /* toggling PGE flushes global entries too */
+        write_cr4(cr4);
+        tlb_full_flushes++;
+    } else {
+        load_page_directory((uintptr_t)current_directory);
+        tlb_full_flushes++;
+    }
+    gather->count = 0;
+    gather->overflow = 0;
+}
+
+static void set_cr4_bits(uint32_t bits) {
+    write_cr4(read_cr4() | bits);
+}
+
 static void enable_paging(void) {
     uint32_t cr0;
     __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000u; /* Paging enable bit */
+    /* WP makes ring 0 honour read-only pages too, so kernel writes hit copy-on-write. */
+    cr0 |= CR0_PG | CR0_WP;
     __asm__ __volatile__("mov %0, %%cr0" :: "r"(cr0) : "memory");
 }
 
+/* PDPT entries only carry the present bit; R/W and U/S are reserved in PAE. */
+static void setup_kernel_pdpt(void) {
+    for (uint32_t i = 0; i < PAE_PDPT_ENTRIES; i++) {
+        phys_addr_t directory = alloc_page_table();
+        if (!directory) {
+            panic("Paging: no frame for a PAE page directory");
+        }
+        kernel_pdpt[i] = directory | PAGE_PRESENT;
+    }
+    kernel_root = (uint32_t *)kernel_pdpt;
+}
+
 void paging_init(const struct boot_info *boot) {
     mapped_pages = 0;
+    large_pages = 0;
     allocated_tables = 0;
     paging_on = 0;
+    pae_on = paging_pae_available();
+    /* PAE always supports 2 MiB pages; classic mode needs PSE for 4 MiB ones. */
+    large_on = pae_on || cpu_has_feature(CPUID_FEAT_PSE);
+    /*
+     * Kernel mappings are the same in every address space (their PDEs are
+     * copied), so with PGE they are marked global and stay in the TLB across
+     * CR3 reloads. User mappings never carry the bit.
+     */
+    global_on = cpu_has_feature(CPUID_FEAT_PGE);
+    kernel_flags = PAGE_WRITE | (global_on ? PAGE_GLOBAL : 0);
+    cr3_loads = 0;
+    cr3_skips = 0;
+    cow_copies = 0;
+    cow_reuses = 0;
+    zero_fills = 0;
+    kmap_used = 0;
+    kmap_peak = 0;
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        kmap_table[i] = 0;
+    }
 
     uintptr_t base_limit = align_up((uintptr_t)_kernel_end, PAGE_SIZE);
     if (base_limit < PAGE_SIZE * 4u) {
@@ -150,12 +480,12 @@ void paging_init(const struct boot_info *boot) {
     }
 
     uintptr_t usable_top = highest_usable(boot);
-    uintptr_t upper_bound = IDENTITY_MAP_LIMIT;
+    uintptr_t upper_bound = PAGING_IDENTITY_MAP_LIMIT;
     if (usable_top && usable_top < upper_bound) {
         upper_bound = usable_top;
     }
     if (!upper_bound) {
-        upper_bound = IDENTITY_MAP_LIMIT;
+        upper_bound = PAGING_IDENTITY_MAP_LIMIT;
     }
     upper_bound = align_down(upper_bound, PAGE_SIZE);
 
@@ -170,58 +500,258 @@ void paging_init(const struct boot_info *boot) {
     }
     identity_limit = align_down(identity_limit, PAGE_SIZE);
 
-    for (uint32_t i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
-        kernel_page_directory[i] = 0;
+    if (pae_on) {
+        setup_kernel_pdpt();
+    } else {
+        for (uint32_t i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
+            kernel_page_directory[i] = 0;
+        }
+        kernel_root = kernel_page_directory;
     }
 
     identity_map_range(0, identity_limit);
 
-    load_page_directory((uintptr_t)kernel_page_directory);
-    current_directory = kernel_page_directory;
+    /* Hook up the kmap window now so every address space copies its PDE. */
+    uint32_t kmap_index;
+    void *kmap_directory = map_directory(kernel_root, KMAP_BASE, &kmap_index);
+    entry_set(kmap_directory, kmap_index, (uintptr_t)kmap_table | PAGE_WRITE | PAGE_PRESENT);
+    kunmap(kmap_directory);
+
+    load_page_directory((uintptr_t)kernel_root);
+    current_directory = kernel_root;
+    if (pae_on) {
+        set_cr4_bits(CR4_PAE);
+    } else if (large_on) {
+        set_cr4_bits(CR4_PSE);
+    }
     enable_paging();
+    if (global_on) {
+        set_cr4_bits(CR4_PGE); /* only after CR0.PG, as the SDM recommends */
+    }
     paging_on = 1;
 
-    kprintf("Paging: enabled, identity-mapped 0x%x bytes (%u pages, %u tables).\n",
-            (uint32_t)identity_limit, mapped_pages, allocated_tables);
+    kprintf("Paging: enabled (%s), identity-mapped 0x%x bytes (%u large pages, %u pages, %u tables).\n",
+            pae_on ? "PAE" : "32-bit", (uint32_t)identity_limit, large_pages, mapped_pages,
+            allocated_tables);
 }
 
 uint32_t *paging_current_directory(void) {
     return current_directory;
 }
 
+uint32_t *paging_kernel_directory(void) {
+    return kernel_root;
+}
+
+/*
+ * Create the kernel page tables covering [virt, virt + size) now. Kernel
+ * PDEs are copied into new address spaces, not kept in sync, so a kernel
+ * region that grows later must reserve its tables before the first address
+ * space exists. Returns 0 if a table could not be allocated.
+ */
+int paging_reserve_kernel_tables(uintptr_t virt, size_t size) {
+    uintptr_t span = (pae_on ? PAE_TABLE_ENTRIES : PAGE_TABLE_ENTRIES) * PAGE_SIZE;
+    uintptr_t end = virt + size;
+    for (uintptr_t addr = virt & ~(span - 1u); addr < end && addr >= (virt & ~(span - 1u));
+         addr += span) {
+        void *table = get_or_create_table(kernel_root, addr, PAGE_WRITE);
+        if (!table) {
+            return 0;
+        }
+        kunmap(table);
+    }
+    return 1;
+}
+
+/* Writing CR3 flushes every non-global TLB entry, so skip it when nothing changes. */
 void paging_switch_directory(uint32_t *dir) {
     if (!dir) {
         return;
     }
+    if (dir == current_directory) {
+        cr3_skips++;
+        return;
+    }
     current_directory = dir;
     load_page_directory((uintptr_t)dir);
+    cr3_loads++;
 }
 
-uint32_t *paging_create_address_space(void) {
-    uintptr_t frame = pmm_alloc_frame_below(identity_limit);
+/* Root tables are loaded into CR3, so they never come from the extended zone. */
+static phys_addr_t alloc_directory_frame(uint32_t flags) {
+    phys_addr_t frame = pmm_alloc_frames_flags(0, flags);
     if (!frame) {
-        frame = pmm_alloc_frame();
-        if (!frame) {
+        return 0;
+    }
+    pmm_page(frame)->flags |= PMM_PAGE_TABLE;
+    return frame;
+}
+
+static inline int user_address(uintptr_t virt) {
+    return virt >= PAGING_USER_BASE && virt < PAGING_USER_LIMIT;
+}
+
+/*
+ * Fill a new page directory from the kernel's: kernel PDEs are copied so
+ * their tables are shared, user PDEs start empty. `base` is the address the
+ * directory's first entry covers.
+ */
+static void copy_kernel_entries(phys_addr_t dest, phys_addr_t src, uintptr_t base) {
+    void *to = kmap(dest);
+    const void *from = kmap(src);
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_DIRECTORY_ENTRIES;
+    uintptr_t span = large_page_size();
+    for (uint32_t i = 0; i < entries; i++) {
+        entry_set(to, i, user_address(base + i * span) ? 0 : entry_get(from, i));
+    }
+    kunmap((void *)from);
+    kunmap(to);
+}
+
+/*
+ * A PAE address space gets its own PDPT and four page directories seeded
+ * from the kernel's, so the kernel's page tables are shared exactly as the
+ * copied PDEs share them in classic mode. All four directories exist up
+ * front: PDPT entries are cached by the CPU at CR3 load and are never
+ * changed afterwards.
+ */
+static uint32_t *create_pae_address_space(void) {
+    phys_addr_t directories[PAE_PDPT_ENTRIES];
+    for (uint32_t i = 0; i < PAE_PDPT_ENTRIES; i++) {
+        directories[i] = alloc_directory_frame(PMM_ALLOC_EXTENDED);
+        if (!directories[i]) {
+            while (i-- > 0) {
+                pmm_free_frame(directories[i]);
+            }
             return NULL;
         }
+        copy_kernel_entries(directories[i], entry_addr(kernel_pdpt[i]), (uintptr_t)i << 30);
+    }
+
+    phys_addr_t root = alloc_directory_frame(0);
+    if (!root) {
+        for (uint32_t i = 0; i < PAE_PDPT_ENTRIES; i++) {
+            pmm_free_frame(directories[i]);
+        }
+        return NULL;
+    }
+    /* The PDPT takes only 32 bytes; the rest of its frame stays unused. */
+    uint64_t *pdpt = kmap(root);
+    for (uint32_t i = 0; i < PAE_PDPT_ENTRIES; i++) {
+        pdpt[i] = directories[i] | PAGE_PRESENT;
     }
+    kunmap(pdpt);
+    return (uint32_t *)(uintptr_t)root;
+}
 
-    uint32_t *dir = (uint32_t *)frame;
-    for (uint32_t i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
-        dir[i] = 0;
+uint32_t *paging_create_address_space(void) {
+    if (pae_on) {
+        return create_pae_address_space();
     }
 
-    for (uint32_t i = 0; i < PAGE_DIRECTORY_ENTRIES; i++) {
-        dir[i] = kernel_page_directory[i];
+    phys_addr_t dir = alloc_directory_frame(0);
+    if (!dir) {
+        return NULL;
     }
-    return dir;
+    copy_kernel_entries(dir, (uintptr_t)kernel_page_directory, 0);
+    return (uint32_t *)(uintptr_t)dir;
 }
 
-int paging_map(uintptr_t virt, uintptr_t phys, uint32_t flags) {
+/* Free a user page table and every frame it maps; returns the frames dropped. */
+static uint32_t free_user_table(phys_addr_t table_phys) {
+    void *table = kmap(table_phys);
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_TABLE_ENTRIES;
+    uint32_t dropped = 0;
+    for (uint32_t i = 0; i < entries; i++) {
+        uint64_t entry = entry_get(table, i);
+        if (entry & PAGE_PRESENT) {
+            pmm_free_frame(entry_addr(entry)); /* drops this mapping's reference */
+            dropped++;
+        }
+    }
+    kunmap(table);
+    pmm_free_frame(table_phys);
+    if (allocated_tables > 0) {
+        allocated_tables--;
+    }
+    return dropped;
+}
+
+/*
+ * Remove every mapping in the user half of `dir`, returning the frames and
+ * the page tables that held them to the PMM. Only user PDEs are walked, so
+ * the shared kernel tables are never touched. Returns the number of pages
+ * unmapped.
+ */
+size_t paging_unmap_user(uint32_t *dir) {
+    if (!dir) {
+        return 0;
+    }
+
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_DIRECTORY_ENTRIES;
+    uintptr_t span = large_page_size();
+    uintptr_t virt = PAGING_USER_BASE;
+    size_t removed = 0;
+    uint32_t freed_tables = 0;
+    while (virt < PAGING_USER_LIMIT) {
+        uint32_t index;
+        void *directory = map_directory(dir, virt, &index);
+        for (; index < entries && virt < PAGING_USER_LIMIT; index++, virt += span) {
+            uint64_t pde = entry_get(directory, index);
+            if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) {
+                continue;
+            }
+            entry_set(directory, index, 0);
+            removed += free_user_table(entry_addr(pde));
+            freed_tables++;
+        }
+        kunmap(directory);
+    }
+
+    if (mapped_pages >= removed) {
+        mapped_pages -= (uint32_t)removed;
+    }
+    /* User entries are never global, so a CR3 reload drops them all. */
+    if (freed_tables && paging_on && dir == current_directory) {
+        load_page_directory((uintptr_t)dir);
+        tlb_full_flushes++;
+    }
+    return removed;
+}
+
+/*
+ * Free an address space made by paging_create_address_space(): its user
+ * mappings, their tables, and the directory (plus PDPT) itself. If `dir` is
+ * still loaded, the kernel directory is switched in first.
+ */
+void paging_destroy_address_space(uint32_t *dir) {
+    if (!dir || dir == kernel_root) {
+        return;
+    }
+    if (dir == current_directory) {
+        paging_switch_directory(kernel_root);
+    }
+
+    (void)paging_unmap_user(dir);
+    if (pae_on) {
+        const uint64_t *pdpt = kmap((uintptr_t)dir);
+        phys_addr_t directories[PAE_PDPT_ENTRIES];
+        for (uint32_t i = 0; i < PAE_PDPT_ENTRIES; i++) {
+            directories[i] = entry_addr(pdpt[i]);
+        }
+        kunmap((void *)pdpt);
+        for (uint32_t i = 0; i < PAE_PDPT_ENTRIES; i++) {
+            pmm_free_frame(directories[i]);
+        }
+    }
+    pmm_free_frame((uintptr_t)dir);
+}
+
+int paging_map(uintptr_t virt, phys_addr_t phys, uint32_t flags) {
     return paging_map_in(current_directory, virt, phys, flags);
 }
 
-int paging_map_in(uint32_t *directory, uintptr_t virt, uintptr_t phys, uint32_t flags) {
+int paging_map_in(uint32_t *directory, uintptr_t virt, phys_addr_t phys, uint32_t flags) {
     int ok = map_single(directory, virt, phys, flags);
     if (!ok) {
         return 0;
@@ -234,45 +764,314 @@ int paging_unmap(uintptr_t virt) {
         return 0;
     }
 
-    uint32_t d_index = pd_index(virt);
-    uint32_t entry = current_directory[d_index];
-    if (!(entry & PAGE_PRESENT)) {
+    void *table = table_of(current_directory, virt, NULL);
+    if (!table) {
         return 0;
     }
 
-    struct page_table *table = (struct page_table *)(entry & PAGE_ALIGN_MASK);
-    uint32_t t_index = pt_index(virt);
-    if (!(table->entries[t_index] & PAGE_PRESENT)) {
+    uint32_t t_index = pte_index(virt);
+    if (!(entry_get(table, t_index) & PAGE_PRESENT)) {
+        kunmap(table);
         return 0;
     }
 
-    table->entries[t_index] = 0;
+    entry_set(table, t_index, 0);
+    kunmap(table);
     if (mapped_pages > 0) {
         mapped_pages--;
     }
     invlpg(virt);
+    tlb_single_flushes++;
+    return 1;
+}
+
+/*
+ * Map `pages` pages from `virt` up, asking `frame_for` for each frame. Each
+ * page table is walked once and its entries are filled in a run; nothing was
+ * present before, so no TLB work is needed. Stops at the first page that
+ * cannot be mapped (no frame, no table, or already present) and returns how
+ * many pages were mapped.
+ */
+size_t paging_map_range(uint32_t *directory, uintptr_t virt, size_t pages, uint32_t flags,
+                        paging_frame_fn frame_for, void *ctx) {
+    if (virt & (PAGE_SIZE - 1u)) {
+        return 0;
+    }
+
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_TABLE_ENTRIES;
+    size_t done = 0;
+    while (done < pages) {
+        void *table = get_or_create_table(directory, virt, flags | PAGE_WRITE);
+        if (!table) {
+            return done;
+        }
+        for (uint32_t index = pte_index(virt); index < entries && done < pages; index++) {
+            if (entry_get(table, index) & PAGE_PRESENT) {
+                kunmap(table);
+                return done;
+            }
+            phys_addr_t phys = frame_for(virt, ctx);
+            if (!phys || (phys & (PAGE_SIZE - 1u)) || (!pae_on && (phys >> 32))) {
+                kunmap(table);
+                return done;
+            }
+            entry_set(table, index, phys | (flags & PAGE_FLAGS_MASK) | PAGE_PRESENT);
+            mapped_pages++;
+            virt += PAGE_SIZE;
+            done++;
+        }
+        kunmap(table);
+    }
+    return done;
+}
+
+/*
+ * Unmap every present 4 KiB page in [virt, virt + pages * PAGE_SIZE), handing
+ * each old frame to `release` (which may be NULL). Absent tables are skipped
+ * whole and invalidations are batched into one flush at the end. Returns the
+ * number of pages unmapped.
+ */
+size_t paging_unmap_range(uint32_t *directory, uintptr_t virt, size_t pages,
+                          paging_release_fn release, void *ctx) {
+    if (virt & (PAGE_SIZE - 1u)) {
+        return 0;
+    }
+
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, directory);
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_TABLE_ENTRIES;
+    size_t removed = 0;
+    while (pages) {
+        uint32_t index = pte_index(virt);
+        size_t span = entries - index;
+        if (span > pages) {
+            span = pages;
+        }
+
+        void *table = table_of(directory, virt, NULL);
+        if (table) {
+            for (size_t i = 0; i < span; i++) {
+                uint64_t entry = entry_get(table, index + (uint32_t)i);
+                if (!(entry & PAGE_PRESENT)) {
+                    continue;
+                }
+                uintptr_t addr = virt + i * PAGE_SIZE;
+                entry_set(table, index + (uint32_t)i, 0);
+                tlb_gather_add(&gather, addr, entry);
+                if (release) {
+                    release(addr, entry_addr(entry), ctx);
+                }
+                removed++;
+            }
+            kunmap(table);
+        }
+
+        virt += span * PAGE_SIZE;
+        pages -= span;
+    }
+
+    if (mapped_pages >= removed) {
+        mapped_pages -= (uint32_t)removed;
+    }
+    tlb_gather_flush(&gather);
+    return removed;
+}
+
+/*
+ * Rewrite the permission bits of every present 4 KiB page in the range:
+ * PAGE_WRITE and PAGE_USER come from `flags`, everything else is kept. A
+ * copy-on-write page stays read-only until its fault. Returns the number of
+ * pages changed.
+ */
+size_t paging_protect_range(uint32_t *directory, uintptr_t virt, size_t pages, uint32_t flags) {
+    if (virt & (PAGE_SIZE - 1u)) {
+        return 0;
+    }
+
+    const uint64_t perms = PAGE_WRITE | PAGE_USER;
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, directory);
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_TABLE_ENTRIES;
+    size_t changed = 0;
+    while (pages) {
+        uint32_t index = pte_index(virt);
+        size_t span = entries - index;
+        if (span > pages) {
+            span = pages;
+        }
+
+        void *table = table_of(directory, virt, NULL);
+        if (table) {
+            for (size_t i = 0; i < span; i++) {
+                uint64_t entry = entry_get(table, index + (uint32_t)i);
+                if (!(entry & PAGE_PRESENT)) {
+                    continue;
+                }
+                uint64_t updated = (entry & ~perms) | (flags & perms);
+                if (entry & PAGE_COW) {
+                    updated &= ~(uint64_t)PAGE_WRITE;
+                }
+                if (updated != entry) {
+                    entry_set(table, index + (uint32_t)i, updated);
+                    tlb_gather_add(&gather, virt + i * PAGE_SIZE, entry);
+                    changed++;
+                }
+            }
+            kunmap(table);
+        }
+
+        virt += span * PAGE_SIZE;
+        pages -= span;
+    }
+
+    tlb_gather_flush(&gather);
+    return changed;
+}
+
+/*
+ * Map every present page of [virt, virt + pages * PAGE_SIZE) in `src` at the
+ * same address in `dst`, taking a frame reference for each. With
+ * `copy_on_write`, writable pages become read-only copy-on-write in both
+ * address spaces and the first write on either side faults into
+ * paging_handle_fault(); otherwise entries are copied as they are, so both
+ * sides keep writing to the same frames. Returns 0 if `dst` ran out of page
+ * tables; the pages shared so far stay mapped for its teardown.
+ */
+int paging_share_range(uint32_t *src, uint32_t *dst, uintptr_t virt, size_t pages,
+                       int copy_on_write) {
+    if (virt & (PAGE_SIZE - 1u)) {
+        return 0;
+    }
+
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, src);
+    uint32_t entries = pae_on ? PAE_TABLE_ENTRIES : PAGE_TABLE_ENTRIES;
+    int ok = 1;
+    while (pages && ok) {
+        uint32_t index = pte_index(virt);
+        size_t span = entries - index;
+        if (span > pages) {
+            span = pages;
+        }
+
+        void *from = table_of(src, virt, NULL);
+        if (from) {
+            void *to = get_or_create_table(dst, virt, PAGE_USER | PAGE_WRITE);
+            if (!to) {
+                ok = 0;
+            }
+            for (size_t i = 0; ok && i < span; i++) {
+                uint32_t slot = index + (uint32_t)i;
+                uint64_t entry = entry_get(from, slot);
+                if (!(entry & PAGE_PRESENT) || (entry_get(to, slot) & PAGE_PRESENT)) {
+                    continue;
+                }
+                if (copy_on_write && (entry & PAGE_WRITE)) {
+                    entry = (entry & ~(uint64_t)PAGE_WRITE) | PAGE_COW;
+                    entry_set(from, slot, entry);
+                    tlb_gather_add(&gather, virt + i * PAGE_SIZE, entry);
+                }
+                pmm_page_get(entry_addr(entry));
+                entry_set(to, slot, entry);
+                mapped_pages++;
+            }
+            if (to) {
+                kunmap(to);
+            }
+            kunmap(from);
+        }
+
+        virt += span * PAGE_SIZE;
+        pages -= span;
+    }
+
+    tlb_gather_flush(&gather);
+    return ok;
+}
+
+/*
+ * Page-fault hook. Resolves write faults on copy-on-write pages of the
+ * current address space: a frame nobody else maps any more is made writable
+ * in place, a shared one is copied. Returns 0 for every other fault.
+ */
+int paging_handle_fault(uintptr_t addr, uint32_t error) {
+    /* Error code bit 0: page was present (protection fault); bit 1: write. */
+    if ((error & 0x3u) != 0x3u || !user_address(addr)) {
+        return 0;
+    }
+
+    uintptr_t page_addr = addr & PAGE_ALIGN_MASK;
+    void *table = table_of(current_directory, page_addr, NULL);
+    if (!table) {
+        return 0;
+    }
+    uint32_t index = pte_index(page_addr);
+    uint64_t entry = entry_get(table, index);
+    if (!(entry & PAGE_PRESENT) || !(entry & PAGE_COW)) {
+        kunmap(table);
+        return 0;
+    }
+
+    phys_addr_t old = entry_addr(entry);
+    uint64_t flags = (entry & PAGE_FLAGS_MASK & ~(uint64_t)PAGE_COW) | PAGE_WRITE;
+    if (old == zero_frame) {
+        /* First write to anonymous memory: a pre-zeroed frame, no copy. */
+        phys_addr_t fresh = pmm_alloc_frame_color(page_addr, PMM_ALLOC_ZERO | PMM_ALLOC_EXTENDED);
+        if (!fresh) {
+            kunmap(table);
+            return 0;
+        }
+        entry_set(table, index, fresh | flags);
+        pmm_free_frame(old);
+        zero_fills++;
+    } else if (pmm_page(old)->refcount == 1) {
+        entry_set(table, index, old | flags);
+        cow_reuses++;
+    } else {
+        phys_addr_t copy = pmm_alloc_frame_color(page_addr, PMM_ALLOC_EXTENDED);
+        if (!copy) {
+            kunmap(table);
+            return 0;
+        }
+        uint32_t *to = kmap(copy);
+        const uint32_t *from = kmap(old);
+        for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+            to[i] = from[i];
+        }
+        kunmap((void *)from);
+        kunmap(to);
+        entry_set(table, index, copy | flags);
+        pmm_free_frame(old); /* drop this mapping's reference */
+        cow_copies++;
+    }
+    kunmap(table);
+    invlpg(page_addr);
+    tlb_single_flushes++;
     return 1;
 }
 
-uintptr_t paging_resolve(uintptr_t virt) {
+phys_addr_t paging_resolve(uintptr_t virt) {
     return paging_resolve_in(current_directory, virt);
 }
 
-uintptr_t paging_resolve_in(uint32_t *directory, uintptr_t virt) {
-    uint32_t d_index = pd_index(virt);
-    uint32_t entry = directory[d_index];
-    if (!(entry & PAGE_PRESENT)) {
+phys_addr_t paging_resolve_in(uint32_t *directory, uintptr_t virt) {
+    uint64_t pde;
+    void *table = table_of(directory, virt, &pde);
+    if (!table) {
+        if ((pde & PAGE_PRESENT) && (pde & PAGE_LARGE)) {
+            uintptr_t large = large_page_size();
+            return (entry_addr(pde) & ~(phys_addr_t)(large - 1u)) | (virt & (large - 1u));
+        }
         return 0;
     }
 
-    struct page_table *table = (struct page_table *)(entry & PAGE_ALIGN_MASK);
-    uint32_t t_index = pt_index(virt);
-    uint32_t page_entry = table->entries[t_index];
+    uint64_t page_entry = entry_get(table, pte_index(virt));
+    kunmap(table);
     if (!(page_entry & PAGE_PRESENT)) {
         return 0;
     }
 
-    return (page_entry & PAGE_ALIGN_MASK) | (virt & (PAGE_SIZE - 1u));
+    return entry_addr(page_entry) | (virt & (PAGE_SIZE - 1u));
 }
 
 int paging_range_has_flags(uintptr_t virt, size_t len, uint32_t flags) {
@@ -286,19 +1085,23 @@ int paging_range_has_flags(uintptr_t virt, size_t len, uint32_t flags) {
     }
     uintptr_t start = virt & PAGE_ALIGN_MASK;
 
-    for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE) {
-        uint32_t d_index = pd_index(addr);
-        uint32_t pd_entry = current_directory[d_index];
+    for (uintptr_t addr = start; addr < end && addr >= start; addr += PAGE_SIZE) {
+        uint64_t pd_entry;
+        void *table = table_of(current_directory, addr, &pd_entry);
         if (!(pd_entry & PAGE_PRESENT)) {
             return 0;
         }
         if ((flags & PAGE_USER) && !(pd_entry & PAGE_USER)) {
             return 0;
         }
+        if (!table) {
+            /* A large page: its PDE is the leaf, so skip to its last 4 KiB page. */
+            addr |= large_page_size() - PAGE_SIZE;
+            continue;
+        }
 
-        struct page_table *table = (struct page_table *)(pd_entry & PAGE_ALIGN_MASK);
-        uint32_t t_index = pt_index(addr);
-        uint32_t pt_entry = table->entries[t_index];
+        uint64_t pt_entry = entry_get(table, pte_index(addr));
+        kunmap(table);
         if (!(pt_entry & PAGE_PRESENT)) {
             return 0;
         }
@@ -310,6 +1113,47 @@ int paging_range_has_flags(uintptr_t virt, size_t len, uint32_t flags) {
     return 1;
 }
 
+/*
+ * The shared all-zero frame that read faults on anonymous memory map
+ * read-only (copy-on-write where the memory is writable). It keeps a
+ * reference of its own, so it is never freed and a write always replaces it.
+ */
+phys_addr_t paging_zero_page(void) {
+    if (!zero_frame) {
+        zero_frame = pmm_alloc_frame_color(0, PMM_ALLOC_ZERO | PMM_ALLOC_EXTENDED);
+    }
+    return zero_frame;
+}
+
+/* Clear one physical frame, in place or through a kmap slot. */
+void paging_zero_frame(phys_addr_t phys) {
+    void *page = kmap(phys & ~(phys_addr_t)(PAGE_SIZE - 1u));
+    zero_page(page);
+    kunmap(page);
+}
+
+/* Copy `len` bytes into a physical frame at byte `offset`, within one page. */
+void paging_copy_to_frame(phys_addr_t phys, uint32_t offset, const void *src, size_t len) {
+    if (offset >= PAGE_SIZE || len > PAGE_SIZE - offset) {
+        return;
+    }
+    uint8_t *dest = kmap(phys & ~(phys_addr_t)(PAGE_SIZE - 1u));
+    const uint8_t *from = src;
+    for (size_t i = 0; i < len; i++) {
+        dest[offset + i] = from[i];
+    }
+    kunmap(dest);
+}
+
+int paging_pae_available(void) {
+    return cpu_has_feature(CPUID_FEAT_PAE);
+}
+
+/* Highest physical address (exclusive) the selected table format can map. */
+phys_addr_t paging_max_phys(void) {
+    return paging_pae_available() ? (1ull << 36) : (1ull << 32);
+}
+
 int paging_enabled(void) {
     uint32_t cr0;
     __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
@@ -319,11 +1163,24 @@ int paging_enabled(void) {
 struct paging_stats paging_get_stats(void) {
     struct paging_stats stats;
     stats.enabled = paging_on && paging_enabled();
+    stats.pae = pae_on;
     stats.page_directory_phys = (uintptr_t)current_directory;
     stats.identity_base = 0;
     stats.identity_limit = identity_limit;
     stats.mapped_pages = mapped_pages;
+    stats.large_pages = large_pages;
+    stats.large_page_size = large_on ? large_page_size() : 0;
     stats.page_table_count = allocated_tables;
+    stats.global_pages = global_on;
+    stats.cr3_loads = cr3_loads;
+    stats.cr3_skips = cr3_skips;
+    stats.tlb_single_flushes = tlb_single_flushes;
+    stats.tlb_full_flushes = tlb_full_flushes;
+    stats.kmap_slots = KMAP_SLOTS;
+    stats.kmap_peak = kmap_peak;
+    stats.cow_copies = cow_copies;
+    stats.cow_reuses = cow_reuses;
+    stats.zero_fills = zero_fills;
     return stats;
 }
 
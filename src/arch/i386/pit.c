@@ -1,6 +1,7 @@
 #include "osmosis/arch/i386/pit.h"
 #include "osmosis/arch/i386/io.h"
 #include "osmosis/arch/i386/irq.h"
+#include "osmosis/pmm.h"
 
 #define PIT_INPUT_HZ 1193182
 #define PIT_COMMAND  0x43
@@ -45,6 +46,7 @@ uint32_t pit_ticks(void) {
 void pit_wait_ticks(uint32_t delta) {
     uint32_t target = pit_tick_count + delta;
     while (pit_tick_count < target) {
+        pmm_idle_work();
         __asm__ __volatile__("hlt");
     }
 }
@@ -4,6 +4,8 @@
 #include "osmosis/arch/i386/segments.h"
 #include "osmosis/kprintf.h"
 #include "osmosis/arch/i386/serial.h"
+#include "osmosis/process.h"
+#include "osmosis/shm.h"
 #include "osmosis/tty.h"
 #include "osmosis/userland.h"
 
@@ -14,6 +16,7 @@ extern void syscall_stub(void);
 
 #define SYSCALL_EBADF 9
 #define SYSCALL_EFAULT 14
+#define SYSCALL_EBUSY 16
 #define SYSCALL_EINVAL 22
 #define SYSCALL_ENOSYS 38
 
@@ -23,12 +26,26 @@ static uint32_t syscall_write(struct isr_frame *frame);
 static uint32_t syscall_exit(struct isr_frame *frame);
 static uint32_t syscall_getpid(struct isr_frame *frame);
 static uint32_t syscall_brk(struct isr_frame *frame);
+static uint32_t syscall_fork(struct isr_frame *frame);
+static uint32_t syscall_waitpid(struct isr_frame *frame);
+static uint32_t syscall_mmap(struct isr_frame *frame);
+static uint32_t syscall_munmap(struct isr_frame *frame);
+static uint32_t syscall_shm_open(struct isr_frame *frame);
+static uint32_t syscall_shm_map(struct isr_frame *frame);
+static uint32_t syscall_shm_unlink(struct isr_frame *frame);
 
 static const syscall_fn_t syscall_table[] = {
     [SYSCALL_WRITE] = syscall_write,
     [SYSCALL_EXIT] = syscall_exit,
     [SYSCALL_GETPID] = syscall_getpid,
     [SYSCALL_BRK] = syscall_brk,
+    [SYSCALL_FORK] = syscall_fork,
+    [SYSCALL_WAITPID] = syscall_waitpid,
+    [SYSCALL_MMAP] = syscall_mmap,
+    [SYSCALL_MUNMAP] = syscall_munmap,
+    [SYSCALL_SHM_OPEN] = syscall_shm_open,
+    [SYSCALL_SHM_MAP] = syscall_shm_map,
+    [SYSCALL_SHM_UNLINK] = syscall_shm_unlink,
 };
 
 static int32_t syscall_error(int code, const char *context, uint32_t eax, uint32_t eip) {
@@ -64,7 +81,9 @@ static uint32_t syscall_write(struct isr_frame *frame) {
     if (!buf || len == 0) {
         return (uint32_t)syscall_error(SYSCALL_EINVAL, "write: empty buffer", frame->eax, frame->eip);
     }
-    if (!userland_user_range_ok((uintptr_t)buf, len)) {
+    int range_ok = process_current() ? process_user_pointer_ok((uintptr_t)buf, len)
+                                     : userland_user_range_ok((uintptr_t)buf, len);
+    if (!range_ok) {
         return (uint32_t)syscall_error(SYSCALL_EFAULT, "write: invalid user range", frame->eax, frame->eip);
     }
 
@@ -76,18 +95,88 @@ static uint32_t syscall_write(struct isr_frame *frame) {
     return len;
 }
 
+/*
+ * Hand the CPU to the next runnable process, or back to the kernel when none
+ * is left. `frame` now belongs to that process, so its eax is returned
+ * unchanged.
+ */
+static uint32_t reschedule(struct isr_frame *frame) {
+    if (process_schedule(frame) < 0) {
+        process_prepare_kernel_return(frame);
+    }
+    return frame->eax;
+}
+
 static uint32_t syscall_exit(struct isr_frame *frame) {
     uint32_t code = frame->ebx;
+    if (process_current()) {
+        process_sys_exit(frame, (int)code);
+        return reschedule(frame);
+    }
     userland_exit_from_syscall(frame, code);
     return code;
 }
 
 static uint32_t syscall_getpid(struct isr_frame *frame) {
     (void)frame;
+    if (process_current()) {
+        return process_current_pid();
+    }
     return userland_current_pid();
 }
 
+static uint32_t syscall_fork(struct isr_frame *frame) {
+    if (!process_current()) {
+        return (uint32_t)syscall_error(SYSCALL_ENOSYS, "fork: no process context", frame->eax, frame->eip);
+    }
+    return (uint32_t)process_sys_fork(frame);
+}
+
+static uint32_t syscall_waitpid(struct isr_frame *frame) {
+    if (!process_current()) {
+        return (uint32_t)syscall_error(SYSCALL_ENOSYS, "waitpid: no process context", frame->eax, frame->eip);
+    }
+    int ret = process_sys_waitpid(frame, (int)frame->ebx);
+    if (ret == -SYSCALL_EBUSY) {
+        /* Blocked: the exiting child's pid lands in the saved eax. */
+        return reschedule(frame);
+    }
+    return (uint32_t)ret;
+}
+
+/* Returns the new break; brk(0) queries it. Failures leave it unchanged. */
 static uint32_t syscall_brk(struct isr_frame *frame) {
-    (void)frame;
-    return (uint32_t)syscall_error(SYSCALL_ENOSYS, "brk/sbrk placeholder", frame->eax, frame->eip);
+    if (!process_current()) {
+        return (uint32_t)syscall_error(SYSCALL_ENOSYS, "brk: no process context", frame->eax, frame->eip);
+    }
+    return (uint32_t)process_sys_brk(frame->ebx);
+}
+
+static uint32_t syscall_mmap(struct isr_frame *frame) {
+    if (!process_current()) {
+        return (uint32_t)syscall_error(SYSCALL_ENOSYS, "mmap: no process context", frame->eax, frame->eip);
+    }
+    return (uint32_t)process_sys_mmap(frame->ebx, frame->ecx, frame->edx, frame->esi);
+}
+
+static uint32_t syscall_munmap(struct isr_frame *frame) {
+    if (!process_current()) {
+        return (uint32_t)syscall_error(SYSCALL_ENOSYS, "munmap: no process context", frame->eax, frame->eip);
+    }
+    return (uint32_t)process_sys_munmap(frame->ebx, frame->ecx);
+}
+
+static uint32_t syscall_shm_open(struct isr_frame *frame) {
+    return (uint32_t)shm_open(frame->ebx, frame->ecx);
+}
+
+static uint32_t syscall_shm_map(struct isr_frame *frame) {
+    if (!process_current()) {
+        return (uint32_t)syscall_error(SYSCALL_ENOSYS, "shm_map: no process context", frame->eax, frame->eip);
+    }
+    return (uint32_t)process_sys_shm_map((int)frame->ebx, frame->ecx);
+}
+
+static uint32_t syscall_shm_unlink(struct isr_frame *frame) {
+    return (uint32_t)shm_unlink((int)frame->ebx);
 }
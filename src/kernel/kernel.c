@@ -16,6 +16,7 @@
 #include "osmosis/arch/i386/paging.h"
 #include "osmosis/pmm.h"
 #include "osmosis/kmalloc.h"
+#include "osmosis/vmalloc.h"
 #include "osmosis/tty.h"
 #include "osmosis/shell.h"
 #include "osmosis/userland.h"
@@ -43,8 +44,16 @@ void kernel_main(uint32_t mb_magic, uint32_t mb_info_addr) {
     kprintf("IRQ routing: PIC remapped to %d-%d\n", IRQ_BASE, IRQ_MAX);
     kprintf("Keyboard: PS/2 set 1 (IRQ1)\n");
     pmm_init(boot);
+#ifdef CONFIG_PMM_COLORING
+    kprintf("PMM: page coloring with %u colors\n", pmm_set_colors(pmm_cache_colors()));
+#endif
+#ifdef CONFIG_BOOT_BENCH
+    pmm_benchmark(); /* must run before paging: touches every free frame */
+    pmm_color_benchmark();
+#endif
     paging_init(boot);
     kmalloc_init();
+    vmalloc_init();
     tss_init(KERNEL_BOOT_STACK_TOP);
     syscall_init();
     shell_init(boot);
@@ -6,126 +6,432 @@
 #include "osmosis/kprintf.h"
 #include "osmosis/pmm.h"
 
-#define HEAP_MAX_SIZE (2u * 1024u * 1024u) /* 2 MiB heap */
-#define HEAP_ALIGNMENT 8u
+#define HEAP_MIN_SIZE (2u * 1024u * 1024u)
+#define HEAP_MEMORY_SHARE 4u    /* the heap may grow to a quarter of physical memory */
+#define HEAP_TRIM_HIGH 64u      /* free pages kept mapped before a trim */
+#define HEAP_TRIM_LOW 16u       /* free pages a trim leaves mapped */
+#define PMM_LOW_WATER_SHARE 32u /* under 1/32 of memory free, trim everything */
+#define SLAB_GRANULE 16u /* class sizes are multiples of this */
+#define RUN_BINS 10u     /* free runs binned by length: [1], [2,3], [4,7], ... [512,) */
+
+/*
+ * The heap is a run of pages, each described by an entry in `pages` rather
+ * than by in-band headers. Requests up to KMALLOC_MAX_SMALL are served from
+ * one-page slabs of a size class, with the free objects linked through their
+ * own first word; larger requests take whole pages. The size classes are
+ * kmem caches like the ones kmem_cache_create() makes for typed objects.
+ *
+ * Free page runs carry boundary tags: the head and the last page both record
+ * the length, so a freed run merges with free neighbours on either side in
+ * O(1). Runs sit in size bins and a run ending at heap_top is given back to
+ * the untouched space above it.
+ *
+ * Pages get a frame when a run is handed out and keep it when the run is
+ * freed, so bursts reuse them cheaply. Once more than HEAP_TRIM_HIGH free
+ * pages hold frames, or the PMM runs low, free pages are unmapped and their
+ * frames returned.
+ */
+enum heap_page_kind {
+    HEAP_PAGE_UNUSED = 0, /* above heap_top */
+    HEAP_PAGE_FREE,       /* head of a free run */
+    HEAP_PAGE_FREE_END,   /* last page of a free run of two or more pages */
+    HEAP_PAGE_SLAB,
+    HEAP_PAGE_LARGE,      /* head of an allocated run */
+    HEAP_PAGE_TAIL        /* inside a run; only meaningful on a run's last page */
+};
+
+struct heap_page {
+    uint8_t kind;
+    uint8_t mapped;      /* backed by a frame */
+    uint16_t inuse;      /* slab: live objects */
+    uint32_t count;      /* run head and free run end: pages in the run */
+    void *freelist;      /* slab: first free object */
+    struct heap_page *prev; /* slab: partial list; free run: its bin */
+    struct heap_page *next;
+    struct kmem_cache *cache; /* slab */
+};
+
+/*
+ * Objects sit `stride` bytes apart from the start of each slab page. Free
+ * ones are linked through the word at `link`: the first word for plain
+ * caches, a word past the object for caches with a constructor, so a
+ * constructed object stays intact while it waits on the free list.
+ */
+struct kmem_cache {
+    const char *name;
+    uint32_t size;
+    uint32_t align;
+    uint32_t stride;
+    uint32_t link;
+    uint32_t per_slab;
+    void (*ctor)(void *obj);
+    struct heap_page *partial; /* slabs with at least one free object */
+    uint32_t slabs;
+    uint32_t active;
+    uint32_t allocs;
+    uint32_t ctor_calls;
+    struct kmem_cache *next; /* in `caches` */
+};
 
-extern char _kernel_end[];
+static const uint16_t class_sizes[KMALLOC_CLASS_COUNT] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 2048,
+};
 
-struct heap_block {
-    size_t size; /* total bytes including header */
-    struct heap_block *next;
+static const char *const class_names[KMALLOC_CLASS_COUNT] = {
+    "kmalloc-16",  "kmalloc-32",  "kmalloc-48",  "kmalloc-64",   "kmalloc-96",
+    "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384",  "kmalloc-512",
+    "kmalloc-768", "kmalloc-1024", "kmalloc-2048",
 };
 
+static struct kmem_cache classes[KMALLOC_CLASS_COUNT];
+static struct kmem_cache *caches = NULL; /* from kmem_cache_create, oldest first */
+static uint8_t class_for[KMALLOC_MAX_SMALL / SLAB_GRANULE]; /* by (size - 1) / 16 */
+static struct heap_page *pages = NULL; /* at the start of the heap region */
+static struct heap_page *free_bins[RUN_BINS];
+
 static uintptr_t heap_base = 0;
 static uintptr_t heap_limit = 0;
 static uintptr_t heap_top = 0;
-static uintptr_t heap_mapped_end = 0;
-static struct heap_block *free_list = NULL;
+static uintptr_t heap_high = 0; /* highest heap_top so far; nothing above is mapped */
+static uint32_t mapped_pages = 0;
+static uint32_t free_mapped = 0; /* free pages still holding a frame */
+static uint32_t trimmed_pages = 0;
 static uint32_t total_allocs = 0;
 static uint32_t total_frees = 0;
+static uint32_t large_pages = 0;
+static uint32_t bad_frees = 0;
 
 static inline uintptr_t align_up(uintptr_t value, uintptr_t align) {
     return (value + align - 1u) & ~(align - 1u);
 }
 
-static int ensure_capacity(uintptr_t new_top) {
-    if (new_top > heap_limit) {
-        return 0;
+static inline uintptr_t page_addr(const struct heap_page *page) {
+    return heap_base + (uintptr_t)(page - pages) * PAGE_SIZE;
+}
+
+static phys_addr_t heap_frame(uintptr_t virt, void *ctx) {
+    (void)ctx;
+    return pmm_alloc_frame_color(virt, PMM_ALLOC_ZERO);
+}
+
+static void release_heap_frame(uintptr_t virt, phys_addr_t phys, void *ctx) {
+    (void)virt;
+    (void)ctx;
+    pmm_free_frame(phys);
+}
+
+void kmalloc_init(void) {
+    /*
+     * The heap region is sized from physical memory and its page tables are
+     * created now, so address spaces created later share them. The page
+     * descriptors sit at its start and are the only pages mapped up front.
+     */
+    uint32_t region_pages = pmm_total_frames() / HEAP_MEMORY_SHARE;
+    if (region_pages < HEAP_MIN_SIZE / PAGE_SIZE) {
+        region_pages = HEAP_MIN_SIZE / PAGE_SIZE;
     }
+    if (region_pages > (PAGING_HEAP_LIMIT - PAGING_HEAP_BASE) / PAGE_SIZE) {
+        region_pages = (PAGING_HEAP_LIMIT - PAGING_HEAP_BASE) / PAGE_SIZE;
+    }
+    uint32_t desc_pages =
+        (uint32_t)(align_up(region_pages * sizeof(struct heap_page), PAGE_SIZE) / PAGE_SIZE);
 
-    while (heap_mapped_end < new_top) {
-        uintptr_t frame = pmm_alloc_frame();
-        if (!frame) {
-            return 0;
+    pages = (struct heap_page *)PAGING_HEAP_BASE;
+    heap_base = PAGING_HEAP_BASE + desc_pages * PAGE_SIZE;
+    heap_limit = PAGING_HEAP_BASE + region_pages * PAGE_SIZE;
+    heap_top = heap_base;
+    heap_high = heap_base;
+
+    for (uint32_t i = 0; i < KMALLOC_CLASS_COUNT; i++) {
+        classes[i].name = class_names[i];
+        classes[i].size = class_sizes[i];
+        classes[i].align = SLAB_GRANULE;
+        classes[i].stride = class_sizes[i];
+        classes[i].link = 0;
+        classes[i].per_slab = PAGE_SIZE / class_sizes[i];
+    }
+    uint32_t c = 0;
+    for (uint32_t i = 0; i < KMALLOC_MAX_SMALL / SLAB_GRANULE; i++) {
+        while (class_sizes[c] < (i + 1u) * SLAB_GRANULE) {
+            c++;
         }
+        class_for[i] = (uint8_t)c;
+    }
+
+    if (!paging_reserve_kernel_tables(PAGING_HEAP_BASE, region_pages * PAGE_SIZE) ||
+        paging_map_range(paging_kernel_directory(), PAGING_HEAP_BASE, desc_pages, PAGE_WRITE,
+                         heap_frame, NULL) != desc_pages) {
+        kprintf("kmalloc: failed to set up a %u KiB heap\n", region_pages * (PAGE_SIZE / 1024u));
+        heap_limit = heap_base;
+    }
+}
 
-        if (!paging_map(heap_mapped_end, frame, PAGE_WRITE)) {
+/* Give every page of a run a frame; pages freed earlier may still have one. */
+static int map_run(struct heap_page *run, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (run[i].mapped) {
+            free_mapped--;
+            continue;
+        }
+        if (paging_map_range(paging_kernel_directory(), page_addr(&run[i]), 1, PAGE_WRITE,
+                             heap_frame, NULL) != 1) {
+            free_mapped += i; /* the run is freed again with [0, i) mapped */
             return 0;
         }
+        run[i].mapped = 1;
+        mapped_pages++;
+    }
+    return 1;
+}
 
-        for (uintptr_t *ptr = (uintptr_t *)heap_mapped_end;
-             ptr < (uintptr_t *)(heap_mapped_end + PAGE_SIZE);
-             ptr++) {
-            *ptr = 0;
-        }
+/* Unmap the free pages in [first, first + count) and return their frames. */
+static void unmap_free(struct heap_page *first, uint32_t count) {
+    uint32_t removed = (uint32_t)paging_unmap_range(paging_kernel_directory(), page_addr(first),
+                                                    count, release_heap_frame, NULL);
+    for (uint32_t i = 0; i < count; i++) {
+        first[i].mapped = 0;
+    }
+    mapped_pages -= removed;
+    free_mapped -= removed;
+    trimmed_pages += removed;
+}
 
-        heap_mapped_end += PAGE_SIZE;
+static int pmm_low(void) {
+    return pmm_free_frame_count() < pmm_total_frames() / PMM_LOW_WATER_SHARE;
+}
+
+/*
+ * Unmap free pages until at most `keep` are left holding frames: first the
+ * space above heap_top, then free runs from the largest bin down.
+ */
+static void trim(uint32_t keep) {
+    if (heap_high > heap_top) {
+        unmap_free(&pages[(heap_top - heap_base) / PAGE_SIZE],
+                   (uint32_t)((heap_high - heap_top) / PAGE_SIZE));
+        heap_high = heap_top;
+    }
+    for (uint32_t bin = RUN_BINS; bin-- > 0 && free_mapped > keep;) {
+        for (struct heap_page *run = free_bins[bin]; run && free_mapped > keep; run = run->next) {
+            unmap_free(run, run->count);
+        }
     }
+}
 
-    return 1;
+static uint32_t bin_of(uint32_t count) {
+    uint32_t bin = 0;
+    while (count > 1u && bin + 1u < RUN_BINS) {
+        count >>= 1;
+        bin++;
+    }
+    return bin;
 }
 
-void kmalloc_init(void) {
-    struct paging_stats pstats = paging_get_stats();
-    uintptr_t end = align_up((uintptr_t)_kernel_end, PAGE_SIZE);
-    heap_base = align_up(pstats.identity_limit, PAGE_SIZE);
-    if (heap_base < end) {
-        heap_base = end;
+static void bin_insert(struct heap_page *run, uint32_t count) {
+    run->kind = HEAP_PAGE_FREE;
+    run->count = count;
+    if (count > 1u) {
+        run[count - 1u].kind = HEAP_PAGE_FREE_END;
+        run[count - 1u].count = count;
     }
-    heap_limit = heap_base + HEAP_MAX_SIZE;
-    heap_top = heap_base;
-    heap_mapped_end = heap_base;
+    struct heap_page **bin = &free_bins[bin_of(count)];
+    run->prev = NULL;
+    run->next = *bin;
+    if (*bin) {
+        (*bin)->prev = run;
+    }
+    *bin = run;
+}
 
-    if (!ensure_capacity(heap_base + PAGE_SIZE)) {
-        kprintf("kmalloc: failed to map initial page\n");
+static void bin_remove(struct heap_page *run) {
+    if (run->prev) {
+        run->prev->next = run->next;
     } else {
-        heap_top = heap_base;
+        free_bins[bin_of(run->count)] = run->next;
+    }
+    if (run->next) {
+        run->next->prev = run->prev;
     }
+    run->prev = NULL;
+    run->next = NULL;
 }
 
-static struct heap_block **find_suitable_block(size_t needed) {
-    struct heap_block **cursor = &free_list;
-    while (*cursor) {
-        if ((*cursor)->size >= needed) {
-            return cursor;
+/*
+ * Segregated fit: the first run long enough in the request's own bin, else
+ * any run of a larger bin, else fresh pages from the top of the heap. The
+ * unused end of a run goes back to its bin.
+ */
+static void free_pages(struct heap_page *run);
+
+static struct heap_page *alloc_pages(uint32_t count) {
+    struct heap_page *run = NULL;
+    for (uint32_t bin = bin_of(count); bin < RUN_BINS && !run; bin++) {
+        for (struct heap_page *cand = free_bins[bin]; cand; cand = cand->next) {
+            if (cand->count >= count) {
+                run = cand;
+                break;
+            }
         }
-        cursor = &(*cursor)->next;
     }
-    return NULL;
+    if (run) {
+        bin_remove(run);
+        if (run->count > count) {
+            bin_insert(run + count, run->count - count);
+        }
+    } else {
+        if (count > (heap_limit - heap_top) / PAGE_SIZE) {
+            return NULL;
+        }
+        run = &pages[(heap_top - heap_base) / PAGE_SIZE];
+        heap_top += count * PAGE_SIZE;
+        if (heap_top > heap_high) {
+            heap_high = heap_top;
+        }
+    }
+    run->count = count;
+
+    if (!map_run(run, count)) {
+        free_pages(run);
+        return NULL;
+    }
+    return run;
 }
 
-static void split_block(struct heap_block *block, size_t needed) {
-    if (block->size <= needed + sizeof(struct heap_block) + HEAP_ALIGNMENT) {
+/*
+ * Return a run, merging it with free runs on both sides. Only boundary pages
+ * are rewritten: a run's old head becomes interior, so a second kfree of it
+ * is caught.
+ */
+static void free_pages(struct heap_page *run) {
+    uint32_t count = run->count;
+    run->kind = HEAP_PAGE_TAIL;
+    if (run > pages) {
+        struct heap_page *below = run - 1;
+        if (below->kind == HEAP_PAGE_FREE_END) {
+            below -= below->count - 1u;
+        }
+        if (below->kind == HEAP_PAGE_FREE) {
+            bin_remove(below);
+            below[below->count - 1u].kind = HEAP_PAGE_TAIL;
+            count += below->count;
+            run = below;
+        }
+    }
+    struct heap_page *above = run + count;
+    if (page_addr(above) < heap_top && above->kind == HEAP_PAGE_FREE) {
+        bin_remove(above);
+        above->kind = HEAP_PAGE_TAIL;
+        count += above->count;
+    }
+
+    if (page_addr(run + count) == heap_top) {
+        heap_top = page_addr(run); /* back to untouched space; frames stay until a trim */
         return;
     }
+    bin_insert(run, count);
+}
 
-    uintptr_t block_addr = (uintptr_t)block;
-    uintptr_t next_addr = block_addr + needed;
-    struct heap_block *next = (struct heap_block *)next_addr;
-    next->size = block->size - needed;
-    next->next = block->next;
+static void partial_remove(struct kmem_cache *cls, struct heap_page *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        cls->partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
 
-    block->size = needed;
-    block->next = next;
+static void partial_push(struct kmem_cache *cls, struct heap_page *slab) {
+    slab->prev = NULL;
+    slab->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = slab;
+    }
+    cls->partial = slab;
 }
 
-static void *alloc_from_free(size_t total_size) {
-    struct heap_block **location = find_suitable_block(total_size);
-    if (!location) {
+/*
+ * Carve a fresh page into objects of the cache, linked in address order and
+ * constructed once here; they keep that state across free and alloc.
+ */
+static struct heap_page *new_slab(struct kmem_cache *cls) {
+    struct heap_page *slab = alloc_pages(1);
+    if (!slab) {
         return NULL;
     }
+    slab->kind = HEAP_PAGE_SLAB;
+    slab->cache = cls;
+    slab->inuse = 0;
+
+    uint8_t *base = (uint8_t *)page_addr(slab);
+    for (uint32_t i = 0; i < cls->per_slab; i++) {
+        uint8_t *obj = base + i * cls->stride;
+        if (cls->ctor) {
+            cls->ctor(obj);
+            cls->ctor_calls++;
+        }
+        *(void **)(obj + cls->link) = i + 1u < cls->per_slab ? obj + cls->stride : NULL;
+    }
+    slab->freelist = base;
 
-    struct heap_block *block = *location;
-    split_block(block, total_size);
-    *location = block->next;
-
-    return (void *)((uintptr_t)block + sizeof(struct heap_block));
+    cls->slabs++;
+    partial_push(cls, slab);
+    return slab;
 }
 
-static void *alloc_from_bump(size_t total_size) {
-    uintptr_t aligned_top = align_up(heap_top, HEAP_ALIGNMENT);
-    uintptr_t new_top = aligned_top + total_size;
+static void *alloc_from(struct kmem_cache *cls) {
+    struct heap_page *slab = cls->partial;
+    if (!slab) {
+        slab = new_slab(cls);
+        if (!slab) {
+            return NULL;
+        }
+    }
 
-    if (!ensure_capacity(new_top)) {
-        return NULL;
+    uint8_t *obj = slab->freelist;
+    slab->freelist = *(void **)(obj + cls->link);
+    slab->inuse++;
+    cls->active++;
+    cls->allocs++;
+    if (!slab->freelist) {
+        partial_remove(cls, slab);
+    }
+    return obj;
+}
+
+static void free_small(struct heap_page *slab, void *ptr) {
+    struct kmem_cache *cls = slab->cache;
+    uintptr_t offset = (uintptr_t)ptr - page_addr(slab);
+    if (offset % cls->stride != 0 || offset / cls->stride >= cls->per_slab) {
+        bad_frees++;
+        kprintf("kfree: 0x%x is not a %s object\n", (uint32_t)(uintptr_t)ptr, cls->name);
+        return;
     }
 
-    struct heap_block *block = (struct heap_block *)aligned_top;
-    block->size = total_size;
-    block->next = NULL;
+    if (!slab->freelist) {
+        partial_push(cls, slab); /* was full */
+    }
+    *(void **)((uint8_t *)ptr + cls->link) = slab->freelist;
+    slab->freelist = ptr;
+    slab->inuse--;
+    cls->active--;
+
+    /* Keep one empty slab per cache so alloc/free at a boundary stays cheap. */
+    if (slab->inuse == 0 && (slab->prev || slab->next)) {
+        partial_remove(cls, slab);
+        cls->slabs--;
+        slab->count = 1;
+        free_pages(slab);
+        free_mapped++;
+    }
+}
 
-    heap_top = new_top;
-    return (void *)((uintptr_t)block + sizeof(struct heap_block));
+static void maybe_trim(void) {
+    if (free_mapped > HEAP_TRIM_HIGH || (free_mapped && pmm_low())) {
+        trim(pmm_low() ? 0 : HEAP_TRIM_LOW);
+    }
 }
 
 void *kmalloc(size_t size) {
@@ -133,11 +439,20 @@ void *kmalloc(size_t size) {
         return NULL;
     }
 
-    size_t total_size = align_up(size + sizeof(struct heap_block), HEAP_ALIGNMENT);
-
-    void *ptr = alloc_from_free(total_size);
-    if (!ptr) {
-        ptr = alloc_from_bump(total_size);
+    void *ptr = NULL;
+    if (size <= KMALLOC_MAX_SMALL) {
+        ptr = alloc_from(&classes[class_for[(size - 1u) / SLAB_GRANULE]]);
+    } else if (size <= heap_limit - heap_base) {
+        uint32_t count = (uint32_t)(align_up(size, PAGE_SIZE) / PAGE_SIZE);
+        struct heap_page *run = alloc_pages(count);
+        if (run) {
+            run->kind = HEAP_PAGE_LARGE;
+            for (uint32_t i = 1; i < count; i++) {
+                run[i].kind = HEAP_PAGE_TAIL;
+            }
+            large_pages += count;
+            ptr = (void *)page_addr(run);
+        }
     }
 
     if (ptr) {
@@ -146,24 +461,101 @@ void *kmalloc(size_t size) {
     return ptr;
 }
 
-static void insert_free_block(struct heap_block *block) {
-    block->next = free_list;
-    free_list = block;
-}
-
 void kfree(void *ptr) {
     if (!ptr) {
         return;
     }
 
-    uintptr_t addr = (uintptr_t)ptr - sizeof(struct heap_block);
-    if (addr < heap_base || addr >= heap_limit) {
+    uintptr_t addr = (uintptr_t)ptr;
+    if (addr < heap_base || addr >= heap_top) {
         return;
     }
 
-    struct heap_block *block = (struct heap_block *)addr;
-    insert_free_block(block);
+    struct heap_page *page = &pages[(addr - heap_base) / PAGE_SIZE];
+    if (page->kind == HEAP_PAGE_SLAB) {
+        free_small(page, ptr);
+    } else if (page->kind == HEAP_PAGE_LARGE && !(addr & (PAGE_SIZE - 1u))) {
+        large_pages -= page->count;
+        free_mapped += page->count;
+        free_pages(page);
+    } else {
+        bad_frees++;
+        kprintf("kfree: 0x%x was not allocated\n", (uint32_t)addr);
+        return;
+    }
     total_frees++;
+    maybe_trim();
+}
+
+/*
+ * A cache of `size`-byte objects aligned to `align` (at least a cache line;
+ * 0 means just that). `ctor`, if given, runs once per object when its slab
+ * is created, and objects must be back in their constructed state when they
+ * are freed. Objects have to fit a page. Returns NULL on bad arguments or
+ * when memory is short.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, uint32_t align,
+                                     void (*ctor)(void *obj)) {
+    if (align < KMEM_CACHE_LINE) {
+        align = KMEM_CACHE_LINE;
+    }
+    if (!size || (align & (align - 1u)) || align > PAGE_SIZE) {
+        return NULL;
+    }
+    uint32_t link = ctor ? (uint32_t)align_up(size, sizeof(void *)) : 0;
+    uint32_t stride = (uint32_t)align_up(ctor ? link + sizeof(void *) : size, align);
+    if (stride > PAGE_SIZE) {
+        kprintf("kmem_cache: %s objects (%u bytes) do not fit a slab\n", name, size);
+        return NULL;
+    }
+
+    struct kmem_cache *cache = kmalloc(sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->name = name;
+    cache->size = size;
+    cache->align = align;
+    cache->stride = stride;
+    cache->link = link;
+    cache->per_slab = PAGE_SIZE / stride;
+    cache->ctor = ctor;
+    cache->partial = NULL;
+    cache->slabs = 0;
+    cache->active = 0;
+    cache->allocs = 0;
+    cache->ctor_calls = 0;
+    cache->next = NULL;
+
+    struct kmem_cache **tail = &caches;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = cache;
+    return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    return cache ? alloc_from(cache) : NULL;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+    uintptr_t addr = (uintptr_t)obj;
+    struct heap_page *page = NULL;
+    if (addr >= heap_base && addr < heap_top) {
+        page = &pages[(addr - heap_base) / PAGE_SIZE];
+    }
+    if (!page || page->kind != HEAP_PAGE_SLAB || page->cache != cache) {
+        bad_frees++;
+        kprintf("kmem_cache_free: 0x%x is not from %s\n", (uint32_t)addr,
+                cache ? cache->name : "(null)");
+        return;
+    }
+    free_small(page, obj);
+    maybe_trim();
 }
 
 struct kmalloc_stats kmalloc_get_stats(void) {
@@ -171,16 +563,68 @@ struct kmalloc_stats kmalloc_get_stats(void) {
     stats.heap_base = heap_base;
     stats.heap_limit = heap_limit;
     stats.heap_top = heap_top;
-    stats.mapped_bytes = heap_mapped_end - heap_base;
+    stats.mapped_bytes = mapped_pages * PAGE_SIZE;
+    stats.cached_bytes = free_mapped * PAGE_SIZE;
+    stats.trimmed_pages = trimmed_pages;
 
     uintptr_t free_bytes = 0;
-    struct heap_block *cursor = free_list;
-    while (cursor) {
-        free_bytes += cursor->size;
-        cursor = cursor->next;
+    uintptr_t largest = heap_limit - heap_top;
+    for (uint32_t bin = 0; bin < RUN_BINS; bin++) {
+        for (struct heap_page *run = free_bins[bin]; run; run = run->next) {
+            free_bytes += run->count * PAGE_SIZE;
+            if (run->count * PAGE_SIZE > largest) {
+                largest = run->count * PAGE_SIZE;
+            }
+        }
     }
     stats.free_bytes = free_bytes;
+    stats.largest_free = largest;
+    stats.large_bytes = large_pages * PAGE_SIZE;
     stats.total_allocs = total_allocs;
     stats.total_frees = total_frees;
+    stats.bad_frees = bad_frees;
     return stats;
 }
+
+/*
+ * Per-class usage. `wasted` is slab memory not holding a live object: free
+ * slots plus the tail of each page that no object fits in.
+ */
+int kmalloc_get_class_stats(uint32_t index, struct kmalloc_class_stats *out) {
+    if (index >= KMALLOC_CLASS_COUNT || !out) {
+        return 0;
+    }
+    const struct kmem_cache *cls = &classes[index];
+    out->size = cls->size;
+    out->active = cls->active;
+    out->slabs = cls->slabs;
+    out->wasted = cls->slabs * PAGE_SIZE - cls->active * cls->size;
+    return 1;
+}
+
+/* Caches from kmem_cache_create first, then the kmalloc size classes. */
+int kmem_cache_get_stats(uint32_t index, struct kmem_cache_stats *out) {
+    if (!out) {
+        return 0;
+    }
+    const struct kmem_cache *cache = caches;
+    while (cache && index) {
+        cache = cache->next;
+        index--;
+    }
+    if (!cache) {
+        if (index >= KMALLOC_CLASS_COUNT) {
+            return 0;
+        }
+        cache = &classes[index];
+    }
+    out->name = cache->name;
+    out->size = cache->size;
+    out->stride = cache->stride;
+    out->per_slab = cache->per_slab;
+    out->slabs = cache->slabs;
+    out->active = cache->active;
+    out->allocs = cache->allocs;
+    out->ctor_calls = cache->ctor_calls;
+    return 1;
+}
@@ -1,56 +1,474 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "osmosis/arch/i386/cpu.h"
+#include "osmosis/arch/i386/irq.h"
+#include "osmosis/arch/i386/paging.h"
 #include "osmosis/boot.h"
 #include "osmosis/kprintf.h"
 #include "osmosis/panic.h"
 #include "osmosis/pmm.h"
 
 #define FRAME_SIZE 4096
-#define PMM_MAX_FRAMES (1024 * 1024) /* 4 GiB / 4 KiB frames */
+#define PMM_MAX_FRAMES (2u * 1024u * 1024u) /* 8 GiB: descriptors must fit the identity map */
+#define EXTENDED_ZONE_START (1024u * 1024u) /* first frame above 4 GiB */
+#define BITS_PER_WORD 32u
+#define NO_BLOCK 0xFFFFFFFFu
+#define MAX_RESERVED_RANGES 6
+#define DMA_ZONE_LIMIT (16u * 1024u * 1024u) /* ISA DMA reaches 24 address bits */
+#define MAGAZINE_SIZE 32u
+#define MAGAZINE_BATCH 16u
+#define ZERO_POOL_TARGET 64u /* pre-zeroed frames kept per zone */
+#define ZERO_IDLE_BATCH 4u   /* frames zeroed per idle call */
+#define BENCH_COLOR_ROUNDS 8u
+#define BENCH_COLOR_MAX_PAGES 1024u
 
-static uint8_t frame_bitmap[PMM_MAX_FRAMES / 8];
+/*
+ * Buddy allocator. Each order keeps a two-level bitmap of free blocks: a set
+ * bit in `bits` marks a free block of 2^order frames that is not part of a
+ * larger free block, and a set bit in `summary` marks a `bits` word holding at
+ * least one free block, so searches skip empty 128-block spans in one test.
+ * No per-frame links are needed, which keeps frames above the identity map
+ * untouched while they sit on a free list.
+ *
+ * Memory is split into zones (ISA DMA, identity-mapped, high) and every zone
+ * owns its own free areas, indexed relative to the zone start. Zone starts are
+ * aligned to the largest block size, so buddies never straddle a boundary and
+ * a search never visits frames the caller cannot use.
+ */
+struct free_area {
+    uint32_t *bits;
+    uint32_t *summary;
+    uint32_t blocks;     /* blocks of this order that fit below frame_count */
+    uint32_t free_count; /* free blocks currently recorded at this order */
+    uint32_t hint;       /* block where the last search succeeded (next-fit) */
+};
+
+struct frame_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+/*
+ * Stack of free single frames parked in front of a zone's buddy lists. The
+ * common alloc/free is a pop/push; the buddy lists are only touched to refill
+ * or drain MAGAZINE_BATCH frames at once. Parked frames are free but are not
+ * visible to the buddy lists, so they neither coalesce nor count toward the
+ * zone's watermark until they are drained.
+ */
+struct magazine {
+    uint32_t frames[MAGAZINE_SIZE];
+    uint32_t count;
+    uint32_t hits;
+    uint32_t misses;
+};
+
+struct zone {
+    const char *name;
+    uint32_t start; /* first frame, aligned to 2^PMM_MAX_ORDER */
+    uint32_t end;   /* one past the last frame */
+    uint32_t free_frames;
+    uint32_t present_frames;
+    uint32_t watermark_min; /* frames kept back from fallback allocations */
+    uint32_t watermark_low; /* below this the zone reports memory pressure */
+    struct free_area areas[PMM_ORDER_COUNT];
+    struct magazine magazine;
+    uint32_t zero_head;  /* pool of pre-zeroed frames linked via struct page */
+    uint32_t zero_count;
+    uint32_t zero_hits;
+    uint32_t zero_misses;
+};
+
+static struct zone zones[PMM_ZONE_COUNT];
+static struct page *page_array;    /* one descriptor per frame, carved at init */
+static uint32_t metadata_frames;   /* frames carved for page_array and bitmaps */
 static uint32_t frame_count;
-static uint32_t free_frame_count;
+static uint32_t free_frame_count;   /* frames on the buddy lists */
+static uint32_t cached_frame_count; /* frames parked in magazines */
+static uint32_t zeroed_frame_count; /* frames parked in zero pools */
+static uint32_t color_count;        /* page colors, 0 when coloring is off */
+static uint32_t color_hits;
+static uint32_t color_misses;
+
+/* Zones tried for each allocation class, preferred zone first. */
+static const uint8_t zone_fallback[][PMM_ZONE_COUNT + 1] = {
+    { PMM_ZONE_HIGH, PMM_ZONE_IDENTITY, PMM_ZONE_DMA, PMM_ZONE_COUNT },
+    { PMM_ZONE_IDENTITY, PMM_ZONE_DMA, PMM_ZONE_COUNT },
+    { PMM_ZONE_DMA, PMM_ZONE_COUNT },
+    { PMM_ZONE_EXTENDED, PMM_ZONE_HIGH, PMM_ZONE_IDENTITY, PMM_ZONE_DMA, PMM_ZONE_COUNT },
+};
+
+static struct frame_range reserved_ranges[MAX_RESERVED_RANGES];
+static uint32_t reserved_count;
 
 extern char _kernel_start[];
 extern char _kernel_end[];
 
-static inline void frame_set(uint32_t frame) {
-    frame_bitmap[frame / 8] |= (uint8_t)(1 << (frame % 8));
+static inline void fill_words(void *dst, uint32_t value, uint32_t count) {
+    __asm__ volatile("rep stosl" : "+D"(dst), "+c"(count) : "a"(value) : "memory");
 }
 
-static inline void frame_clear(uint32_t frame) {
-    frame_bitmap[frame / 8] &= (uint8_t)~(1 << (frame % 8));
+static inline int block_test(const struct free_area *area, uint32_t block) {
+    return (area->bits[block / BITS_PER_WORD] >> (block % BITS_PER_WORD)) & 1u;
 }
 
-static inline int frame_test(uint32_t frame) {
-    return frame_bitmap[frame / 8] & (uint8_t)(1 << (frame % 8));
+static inline void block_set(struct free_area *area, uint32_t block) {
+    uint32_t word = block / BITS_PER_WORD;
+    area->bits[word] |= 1u << (block % BITS_PER_WORD);
+    area->summary[word / BITS_PER_WORD] |= 1u << (word % BITS_PER_WORD);
+    area->free_count++;
 }
 
-static void mark_range(uint64_t base, uint64_t length, int free) {
-    uint64_t start_frame = base / FRAME_SIZE;
-    uint64_t end_frame = (base + length + FRAME_SIZE - 1) / FRAME_SIZE;
+static inline void block_clear(struct free_area *area, uint32_t block) {
+    uint32_t word = block / BITS_PER_WORD;
+    area->bits[word] &= ~(1u << (block % BITS_PER_WORD));
+    if (!area->bits[word]) {
+        area->summary[word / BITS_PER_WORD] &= ~(1u << (word % BITS_PER_WORD));
+    }
+    area->free_count--;
+}
 
-    if (end_frame > frame_count) {
-        end_frame = frame_count;
+/*
+ * Find the first free block in [lo, hi) of one order. The summary level is
+ * consulted first so empty words are skipped 32 at a time; within a word the
+ * block is picked with a single bit scan. The masks restrict the search to a
+ * repeating subset of words and bits (see find_colored_block()); plain
+ * searches pass all ones. Returns NO_BLOCK when none is free.
+ */
+static uint32_t find_free_in_range(const struct free_area *area, uint32_t lo, uint32_t hi,
+                                   uint32_t bits_mask, uint32_t summary_mask) {
+    if (lo >= hi) {
+        return NO_BLOCK;
     }
 
-    for (uint64_t f = start_frame; f < end_frame; f++) {
-        if (free) {
-            if (frame_test((uint32_t)f)) {
-                frame_clear((uint32_t)f);
-                free_frame_count++;
-            }
+    uint32_t first_word = lo / BITS_PER_WORD;
+    uint32_t last_word = (hi - 1u) / BITS_PER_WORD;
+    uint32_t word = first_word;
+
+    while (word <= last_word) {
+        uint32_t s = word / BITS_PER_WORD;
+        uint32_t busy_words = area->summary[s] & summary_mask & (0xFFFFFFFFu << (word % BITS_PER_WORD));
+        if (!busy_words) {
+            word = (s + 1u) * BITS_PER_WORD;
+            continue;
+        }
+
+        word = s * BITS_PER_WORD + (uint32_t)__builtin_ctz(busy_words);
+        if (word > last_word) {
+            break;
+        }
+
+        uint32_t free_bits = area->bits[word] & bits_mask;
+        if (word == first_word) {
+            free_bits &= 0xFFFFFFFFu << (lo % BITS_PER_WORD);
+        }
+        if (word == last_word && (hi % BITS_PER_WORD)) {
+            free_bits &= (1u << (hi % BITS_PER_WORD)) - 1u;
+        }
+        if (free_bits) {
+            return word * BITS_PER_WORD + (uint32_t)__builtin_ctz(free_bits);
+        }
+        word++;
+    }
+
+    return NO_BLOCK;
+}
+
+/* Next-fit search below limit_block: resume at the order's hint, then wrap once. */
+static uint32_t find_free_block(struct free_area *area, uint32_t limit_block) {
+    if (limit_block > area->blocks) {
+        limit_block = area->blocks;
+    }
+    if (!area->free_count || !limit_block) {
+        return NO_BLOCK;
+    }
+
+    uint32_t start = area->hint < limit_block ? area->hint : 0;
+    uint32_t block = find_free_in_range(area, start, limit_block, 0xFFFFFFFFu, 0xFFFFFFFFu);
+    if (block == NO_BLOCK && start > 0) {
+        block = find_free_in_range(area, 0, start, 0xFFFFFFFFu, 0xFFFFFFFFu);
+    }
+    if (block != NO_BLOCK) {
+        area->hint = block;
+    }
+    return block;
+}
+
+/*
+ * Take a block of 2^order frames from one zone. Larger blocks are split on the
+ * way down; the upper half of every split is returned to the next lower order.
+ * Returns the first frame number or NO_BLOCK.
+ */
+static uint32_t buddy_alloc(struct zone *zone, uint32_t order) {
+    for (uint32_t k = order; k < PMM_ORDER_COUNT; k++) {
+        struct free_area *area = &zone->areas[k];
+        uint32_t block = find_free_block(area, area->blocks);
+        if (block == NO_BLOCK) {
+            continue;
+        }
+
+        block_clear(area, block);
+        while (k > order) {
+            k--;
+            block <<= 1;
+            block_set(&zone->areas[k], block | 1u);
+        }
+
+        zone->free_frames -= 1u << order;
+        free_frame_count -= 1u << order;
+        return zone->start + (block << order);
+    }
+    return NO_BLOCK;
+}
+
+/* Return a block and merge it with its buddy for as long as the buddy is free. */
+static void buddy_free(struct zone *zone, uint32_t frame, uint32_t order) {
+    zone->free_frames += 1u << order;
+    free_frame_count += 1u << order;
+
+    uint32_t block = (frame - zone->start) >> order;
+    while (order < PMM_MAX_ORDER) {
+        struct free_area *area = &zone->areas[order];
+        uint32_t buddy = block ^ 1u;
+        if (buddy >= area->blocks || !block_test(area, buddy)) {
+            break;
+        }
+        block_clear(area, buddy);
+        block >>= 1;
+        order++;
+    }
+    block_set(&zone->areas[order], block);
+}
+
+/* Every `stride`-th bit of a word, starting at bit `first`. */
+static uint32_t stride_mask(uint32_t first, uint32_t stride) {
+    uint32_t mask = 0;
+    for (uint32_t bit = first; bit < BITS_PER_WORD; bit += stride) {
+        mask |= 1u << bit;
+    }
+    return mask;
+}
+
+/*
+ * Find a free block whose index is `color` modulo `colors` (a power of two of
+ * at most PMM_MAX_COLORS). Up to 32 colors the matching blocks repeat inside
+ * every bitmap word; above that they sit at one bit position in every
+ * (colors / 32)-th word, which the summary mask selects.
+ */
+static uint32_t find_colored_block(const struct free_area *area, uint32_t color, uint32_t colors) {
+    if (!area->free_count) {
+        return NO_BLOCK;
+    }
+    if (colors <= BITS_PER_WORD) {
+        return find_free_in_range(area, 0, area->blocks, stride_mask(color, colors), 0xFFFFFFFFu);
+    }
+    return find_free_in_range(area, 0, area->blocks, 1u << (color % BITS_PER_WORD),
+                              stride_mask(color / BITS_PER_WORD, colors / BITS_PER_WORD));
+}
+
+/*
+ * Take one frame of the given color from a zone. A block at order k covers the
+ * colors of its 2^k frames, so the search looks for a block containing the
+ * color and splits it, keeping the half that holds the wanted frame. Zone
+ * starts are aligned to 2^PMM_MAX_ORDER, which is at least PMM_MAX_COLORS, so
+ * zone-relative and absolute frame numbers share a color.
+ */
+static uint32_t buddy_alloc_color(struct zone *zone, uint32_t color) {
+    for (uint32_t k = 0; k < PMM_ORDER_COUNT; k++) {
+        struct free_area *area = &zone->areas[k];
+        uint32_t block;
+        if ((color_count >> k) > 1u) {
+            block = find_colored_block(area, color >> k, color_count >> k);
         } else {
-            if (!frame_test((uint32_t)f)) {
-                free_frame_count--;
-                frame_set((uint32_t)f);
+            block = find_free_block(area, area->blocks);
+        }
+        if (block == NO_BLOCK) {
+            continue;
+        }
+
+        block_clear(area, block);
+        while (k > 0) {
+            k--;
+            block = (block << 1) | ((color >> k) & 1u); /* half holding the color */
+            block_set(&zone->areas[k], block ^ 1u);
+        }
+
+        zone->free_frames--;
+        free_frame_count--;
+        return zone->start + block;
+    }
+    return NO_BLOCK;
+}
+
+static struct zone *zone_of(uint32_t frame) {
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        if (frame >= zones[z].start && frame < zones[z].end) {
+            return &zones[z];
+        }
+    }
+    return NULL;
+}
+
+/* Hand [start, end) to the buddy lists as the largest naturally aligned blocks. */
+static void free_frame_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        struct zone *zone = zone_of(start);
+        uint32_t stop = end < zone->end ? end : zone->end;
+        zone->present_frames += stop - start;
+
+        while (start < stop) {
+            uint32_t order = PMM_MAX_ORDER;
+            while (order > 0 &&
+                   ((start & ((1u << order) - 1u)) || start + (1u << order) > stop)) {
+                order--;
+            }
+            buddy_free(zone, start, order);
+            start += 1u << order;
+        }
+    }
+}
+
+static uint32_t alloc_class(uint32_t flags) {
+    if (flags & PMM_ALLOC_DMA) {
+        return 2;
+    }
+    if (flags & PMM_ALLOC_IDENTITY) {
+        return 1;
+    }
+    if (flags & PMM_ALLOC_EXTENDED) {
+        return 3;
+    }
+    return 0;
+}
+
+/*
+ * Walk the fallback list for an allocation class. Only the preferred zone may
+ * be drained completely; a fallback zone keeps watermark_min frames back for
+ * the callers that cannot use anything else (page tables, DMA buffers).
+ */
+static uint32_t zone_alloc(uint32_t order, uint32_t flags) {
+    const uint8_t *list = zone_fallback[alloc_class(flags)];
+    for (uint32_t i = 0; list[i] != PMM_ZONE_COUNT; i++) {
+        struct zone *zone = &zones[list[i]];
+        if (zone->free_frames < (1u << order)) {
+            continue;
+        }
+        if (i > 0 && zone->free_frames - (1u << order) < zone->watermark_min) {
+            continue;
+        }
+        uint32_t frame = buddy_alloc(zone, order);
+        if (frame != NO_BLOCK) {
+            return frame;
+        }
+    }
+    return NO_BLOCK;
+}
+
+/* Single-frame fast path: pop from the preferred zone's magazine, refilling it in a batch. */
+static uint32_t magazine_alloc(uint32_t flags) {
+    struct zone *zone = &zones[zone_fallback[alloc_class(flags)][0]];
+    struct magazine *mag = &zone->magazine;
+
+    if (mag->count) {
+        mag->hits++;
+    } else {
+        mag->misses++;
+        while (mag->count < MAGAZINE_BATCH) {
+            uint32_t frame = buddy_alloc(zone, 0);
+            if (frame == NO_BLOCK) {
+                break;
             }
+            mag->frames[mag->count++] = frame;
+            cached_frame_count++;
+        }
+        if (!mag->count) {
+            return zone_alloc(0, flags); /* preferred zone empty: fall back */
+        }
+    }
+
+    cached_frame_count--;
+    return mag->frames[--mag->count];
+}
+
+static void magazine_drain(struct zone *zone, uint32_t count) {
+    struct magazine *mag = &zone->magazine;
+    while (count-- && mag->count) {
+        buddy_free(zone, mag->frames[--mag->count], 0);
+        cached_frame_count--;
+    }
+}
+
+static void magazine_free(struct zone *zone, uint32_t frame) {
+    struct magazine *mag = &zone->magazine;
+    if (mag->count == MAGAZINE_SIZE) {
+        magazine_drain(zone, MAGAZINE_BATCH);
+    }
+    mag->frames[mag->count++] = frame;
+    cached_frame_count++;
+}
+
+static uint32_t zero_pool_pop(struct zone *zone) {
+    uint32_t frame = zone->zero_head;
+    if (frame == NO_BLOCK) {
+        return NO_BLOCK;
+    }
+    zone->zero_head = page_array[frame].next;
+    zone->zero_count--;
+    zeroed_frame_count--;
+    return frame;
+}
+
+static void zero_pool_push(struct zone *zone, uint32_t frame) {
+    page_array[frame].flags = PMM_PAGE_ZEROED;
+    page_array[frame].next = zone->zero_head;
+    zone->zero_head = frame;
+    zone->zero_count++;
+    zeroed_frame_count++;
+}
+
+/*
+ * Return every parked frame (magazines and zero pools) to the buddy lists so
+ * they can coalesce again. Used when an allocation would otherwise fail.
+ */
+static void reclaim_parked_frames(void) {
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        struct zone *zone = &zones[z];
+        magazine_drain(zone, MAGAZINE_SIZE);
+
+        uint32_t frame;
+        while ((frame = zero_pool_pop(zone)) != NO_BLOCK) {
+            page_array[frame].flags = 0;
+            buddy_free(zone, frame, 0);
         }
     }
 }
 
+static void reserve_range(uint64_t base, uint64_t length) {
+    if (reserved_count >= MAX_RESERVED_RANGES) {
+        panic("PMM reserved range table full");
+    }
+    reserved_ranges[reserved_count].start = (uint32_t)(base / FRAME_SIZE);
+    reserved_ranges[reserved_count].end = (uint32_t)((base + length + FRAME_SIZE - 1) / FRAME_SIZE);
+    reserved_count++;
+}
+
+/* Release [start, end) minus every reserved range, splitting around overlaps. */
+static void free_usable_range(uint32_t start, uint32_t end) {
+    for (uint32_t i = 0; i < reserved_count && start < end; i++) {
+        const struct frame_range *r = &reserved_ranges[i];
+        if (r->end <= start || r->start >= end) {
+            continue;
+        }
+        if (r->start > start) {
+            free_usable_range(start, r->start);
+        }
+        start = r->end;
+    }
+    if (start < end) {
+        free_frame_range(start, end);
+    }
+}
+
 static uint64_t max_usable_address(const struct boot_info *boot) {
     uint64_t max_addr = 0;
     for (uint32_t i = 0; i < boot->region_count; i++) {
@@ -66,6 +484,50 @@ static uint64_t max_usable_address(const struct boot_info *boot) {
     return max_addr;
 }
 
+/*
+ * Collapse the usable regions into sorted, disjoint frame ranges so that
+ * overlapping firmware entries never hand the same frame to the buddy lists
+ * twice. Partial frames at region edges are dropped.
+ */
+static uint32_t collect_usable_ranges(const struct boot_info *boot, struct frame_range *out) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < boot->region_count; i++) {
+        const struct boot_memory_region *region = &boot->regions[i];
+        if (region->type != BOOT_MEMORY_USABLE) {
+            continue;
+        }
+        uint64_t start = (region->base + FRAME_SIZE - 1) / FRAME_SIZE;
+        uint64_t end = (region->base + region->length) / FRAME_SIZE;
+        if (end > frame_count) {
+            end = frame_count;
+        }
+        if (start >= end) {
+            continue;
+        }
+
+        uint32_t pos = count;
+        while (pos > 0 && out[pos - 1].start > start) {
+            out[pos] = out[pos - 1];
+            pos--;
+        }
+        out[pos].start = (uint32_t)start;
+        out[pos].end = (uint32_t)end;
+        count++;
+    }
+
+    uint32_t merged = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (merged && out[i].start <= out[merged - 1].end) {
+            if (out[i].end > out[merged - 1].end) {
+                out[merged - 1].end = out[i].end;
+            }
+            continue;
+        }
+        out[merged++] = out[i];
+    }
+    return merged;
+}
+
 static void reserve_kernel(const struct boot_info *boot) {
     (void)boot;
     uintptr_t kernel_start = (uintptr_t)_kernel_start;
@@ -74,7 +536,7 @@ static void reserve_kernel(const struct boot_info *boot) {
     uintptr_t aligned_start = kernel_start & ~(FRAME_SIZE - 1);
     uintptr_t aligned_end = (kernel_end + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
 
-    mark_range(aligned_start, aligned_end - aligned_start, 0);
+    reserve_range(aligned_start, aligned_end - aligned_start);
 }
 
 static void reserve_bootloader_payload(const struct boot_info *boot) {
@@ -83,7 +545,163 @@ static void reserve_bootloader_payload(const struct boot_info *boot) {
     }
 
     uintptr_t addr = (uintptr_t)boot->multiboot_ptr;
-    mark_range(addr, FRAME_SIZE, 0);
+    reserve_range(addr, FRAME_SIZE);
+}
+
+/*
+ * Carve `frames` contiguous frames for boot-time metadata out of usable memory
+ * that the identity map will cover, preferring frames above the DMA zone. The
+ * range is reserved, so it never reaches the buddy lists.
+ */
+static uint32_t carve_boot_frames(const struct frame_range *usable, uint32_t usable_count,
+                                  uint32_t frames) {
+    const uint32_t identity_end = PAGING_IDENTITY_MAP_LIMIT / FRAME_SIZE;
+    const uint32_t floors[2] = { DMA_ZONE_LIMIT / FRAME_SIZE, 0 };
+
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < usable_count; i++) {
+            uint32_t start = usable[i].start > floors[pass] ? usable[i].start : floors[pass];
+            uint32_t end = usable[i].end < identity_end ? usable[i].end : identity_end;
+
+            int moved = 1;
+            while (moved) {
+                moved = 0;
+                for (uint32_t r = 0; r < reserved_count; r++) {
+                    if (reserved_ranges[r].start < start + frames && reserved_ranges[r].end > start) {
+                        start = reserved_ranges[r].end;
+                        moved = 1;
+                    }
+                }
+            }
+
+            if (start < end && end - start >= frames) {
+                reserve_range((uint64_t)start * FRAME_SIZE, (uint64_t)frames * FRAME_SIZE);
+                return start;
+            }
+        }
+    }
+
+    panic("PMM: no identity-mapped room for frame descriptors");
+}
+
+static void init_zone_bounds(void) {
+    static const char *const names[PMM_ZONE_COUNT] = { "dma", "identity", "high", "extended" };
+    const uint32_t limits[PMM_ZONE_COUNT] = {
+        DMA_ZONE_LIMIT / FRAME_SIZE,
+        PAGING_IDENTITY_MAP_LIMIT / FRAME_SIZE,
+        EXTENDED_ZONE_START,
+        frame_count,
+    };
+    uint32_t zone_start = 0;
+
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        struct zone *zone = &zones[z];
+        uint32_t zone_end = limits[z] < frame_count ? limits[z] : frame_count;
+        if (zone_end < zone_start) {
+            zone_end = zone_start;
+        }
+
+        zone->name = names[z];
+        zone->start = zone_start;
+        zone->end = zone_end;
+        zone->free_frames = 0;
+        zone->present_frames = 0;
+        zone->watermark_min = 0;
+        zone->watermark_low = 0;
+        zone->magazine.count = 0;
+        zone->magazine.hits = 0;
+        zone->magazine.misses = 0;
+        zone->zero_head = NO_BLOCK;
+        zone->zero_count = 0;
+        zone->zero_hits = 0;
+        zone->zero_misses = 0;
+
+        zone_start = zone_end;
+    }
+}
+
+static uint32_t area_words(const struct zone *zone, uint32_t order, uint32_t *summary_words) {
+    uint32_t blocks = (zone->end - zone->start) >> order;
+    uint32_t words = (blocks + BITS_PER_WORD - 1u) / BITS_PER_WORD;
+    *summary_words = (words + BITS_PER_WORD - 1u) / BITS_PER_WORD;
+    return words;
+}
+
+/* Words of bitmap and summary storage the zones need for the detected RAM. */
+static uint32_t free_area_words(void) {
+    uint32_t total = 0;
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        for (uint32_t k = 0; k < PMM_ORDER_COUNT; k++) {
+            uint32_t summary_words;
+            total += area_words(&zones[z], k, &summary_words);
+            total += summary_words;
+        }
+    }
+    return total;
+}
+
+/* Point every free area at its slice of `storage`, which arrives zeroed. */
+static void init_free_areas(uint32_t *storage) {
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        struct zone *zone = &zones[z];
+        for (uint32_t k = 0; k < PMM_ORDER_COUNT; k++) {
+            struct free_area *area = &zone->areas[k];
+            uint32_t summary_words;
+            uint32_t words = area_words(zone, k, &summary_words);
+
+            area->bits = storage;
+            area->summary = storage + words;
+            area->blocks = (zone->end - zone->start) >> k;
+            area->free_count = 0;
+            area->hint = 0;
+            storage += words + summary_words;
+        }
+    }
+}
+
+/*
+ * Size the frame descriptors and buddy bitmaps from the detected RAM and carve
+ * them as one block, so a small machine pays only for the frames it has. The
+ * block is cleared a word at a time; afterwards only the reserved ranges are
+ * pinned, since every other frame is either handed to the buddy lists or is a
+ * hole that no allocation can return.
+ */
+static void init_metadata(const struct frame_range *usable, uint32_t usable_count) {
+    uint32_t page_bytes = frame_count * (uint32_t)sizeof(struct page);
+    uint32_t bytes = page_bytes + free_area_words() * (uint32_t)sizeof(uint32_t);
+    metadata_frames = (bytes + FRAME_SIZE - 1) / FRAME_SIZE;
+    uint32_t first = carve_boot_frames(usable, usable_count, metadata_frames);
+
+    uint8_t *base = (uint8_t *)((uintptr_t)first * FRAME_SIZE);
+    fill_words(base, 0, metadata_frames * (FRAME_SIZE / sizeof(uint32_t)));
+    page_array = (struct page *)base;
+    init_free_areas((uint32_t *)(base + page_bytes));
+
+    for (uint32_t i = 0; i < reserved_count; i++) {
+        uint32_t end = reserved_ranges[i].end < frame_count ? reserved_ranges[i].end : frame_count;
+        for (uint32_t f = reserved_ranges[i].start; f < end; f++) {
+            page_array[f].flags = PMM_PAGE_PINNED;
+        }
+    }
+}
+
+/* Keep roughly 1/32 of a zone, clamped to [16, 1024] frames, for its own callers. */
+static void set_watermarks(void) {
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        struct zone *zone = &zones[z];
+        uint32_t min = zone->present_frames / 32u;
+        if (min < 16u) {
+            min = 16u;
+        }
+        if (min > 1024u) {
+            min = 1024u;
+        }
+        if (min > zone->present_frames) {
+            min = zone->present_frames;
+        }
+        zone->watermark_min = min;
+        zone->watermark_low = min * 2u;
+    }
 }
 
 void pmm_init(const struct boot_info *boot) {
@@ -91,89 +709,510 @@ void pmm_init(const struct boot_info *boot) {
         panic("PMM init requires boot info");
     }
 
+    /* Frames past what the page tables can address, or the descriptors can cover, are ignored. */
     uint64_t highest_address = max_usable_address(boot);
+    uint64_t limit = paging_max_phys();
+    if (limit > (uint64_t)PMM_MAX_FRAMES * FRAME_SIZE) {
+        limit = (uint64_t)PMM_MAX_FRAMES * FRAME_SIZE;
+    }
+    if (highest_address > limit) {
+        kprintf("PMM: ignoring memory above %u MiB\n", (uint32_t)(limit >> 20));
+        highest_address = limit;
+    }
     frame_count = (uint32_t)((highest_address + FRAME_SIZE - 1) / FRAME_SIZE);
 
-    if (frame_count > PMM_MAX_FRAMES) {
-        frame_count = PMM_MAX_FRAMES;
+    free_frame_count = 0;
+    cached_frame_count = 0;
+    zeroed_frame_count = 0;
+    init_zone_bounds();
+
+    /* Keep low memory, the kernel image, and the multiboot info reserved. */
+    reserved_count = 0;
+    reserve_range(0, 0x100000);
+    reserve_kernel(boot);
+    reserve_bootloader_payload(boot);
+
+    struct frame_range usable[BOOT_MAX_MEMORY_REGIONS];
+    uint32_t usable_count = collect_usable_ranges(boot, usable);
+    init_metadata(usable, usable_count);
+    for (uint32_t i = 0; i < usable_count; i++) {
+        free_usable_range(usable[i].start, usable[i].end);
     }
+    set_watermarks();
 
-    for (uint32_t i = 0; i < PMM_MAX_FRAMES / 8; i++) {
-        frame_bitmap[i] = 0xFF;
+    kprintf("PMM: %u frames (%u KiB) detected, %u frames free.\n",
+            frame_count, frame_count * (FRAME_SIZE / 1024), free_frame_count);
+    kprintf("PMM: %u KiB of frame metadata\n", metadata_frames * (FRAME_SIZE / 1024));
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        const struct zone *zone = &zones[z];
+        kprintf("PMM: zone %s [%u MiB, %u MiB) %u frames free, min=%u\n",
+                zone->name, zone->start >> 8, zone->end >> 8,
+                zone->free_frames, zone->watermark_min);
     }
+}
 
-    free_frame_count = 0;
+uintptr_t pmm_alloc_frame(void) {
+    return (uintptr_t)pmm_alloc_frames_flags(0, 0);
+}
 
-    for (uint32_t i = 0; i < boot->region_count; i++) {
-        const struct boot_memory_region *region = &boot->regions[i];
-        if (region->type != BOOT_MEMORY_USABLE) {
-            continue;
+uintptr_t pmm_alloc_frames(uint32_t order) {
+    return (uintptr_t)pmm_alloc_frames_flags(order, 0);
+}
+
+/* Mark a frame just taken off a free list as allocated. Called with IRQs off. */
+static void claim_frame(uint32_t frame, uint32_t order, int zeroed) {
+    struct page *page = &page_array[frame];
+    page->refcount = 1;
+    page->flags = zeroed ? PMM_PAGE_ZEROED : 0;
+    page->order = (uint8_t)order;
+    page->owner = 0;
+}
+
+/* Clear a claimed block that did not come from a zero pool. Runs with IRQs on. */
+static void zero_block(uint32_t frame, uint32_t order) {
+    phys_addr_t addr = (phys_addr_t)frame * FRAME_SIZE;
+    for (uint32_t i = 0; i < (1u << order); i++) {
+        paging_zero_frame(addr + i * FRAME_SIZE);
+    }
+    page_array[frame].flags |= PMM_PAGE_ZEROED;
+}
+
+phys_addr_t pmm_alloc_frames_flags(uint32_t order, uint32_t flags) {
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    uint32_t irq_flags = irq_save();
+    uint32_t frame = NO_BLOCK;
+    int zeroed = 0;
+    if (order == 0 && (flags & PMM_ALLOC_ZERO)) {
+        struct zone *zone = &zones[zone_fallback[alloc_class(flags)][0]];
+        frame = zero_pool_pop(zone);
+        if (frame != NO_BLOCK) {
+            zone->zero_hits++;
+            zeroed = 1;
+        } else {
+            zone->zero_misses++;
         }
-        mark_range(region->base, region->length, 1);
     }
+    if (frame == NO_BLOCK) {
+        frame = order == 0 ? magazine_alloc(flags) : zone_alloc(order, flags);
+    }
+    if (frame == NO_BLOCK && (cached_frame_count || zeroed_frame_count)) {
+        /* Parked single frames may be all that is left, or keep a block split. */
+        reclaim_parked_frames();
+        frame = zone_alloc(order, flags);
+    }
+    if (frame != NO_BLOCK) {
+        claim_frame(frame, order, zeroed);
+    }
+    irq_restore(irq_flags);
 
-    /* Keep low memory and the kernel image reserved. */
-    mark_range(0, 0x100000, 0);
-    reserve_kernel(boot);
-    reserve_bootloader_payload(boot);
+    if (frame == NO_BLOCK) {
+        return 0;
+    }
+    if ((flags & PMM_ALLOC_ZERO) && !zeroed) {
+        zero_block(frame, order);
+    }
+    return (phys_addr_t)frame * FRAME_SIZE;
+}
 
-    kprintf("PMM: %d frames (%d KiB) detected, %d frames free.\n",
-            frame_count, (frame_count * FRAME_SIZE) / 1024, free_frame_count);
+/* Unlink the first frame of `color` from a zone's zero pool. */
+static uint32_t zero_pool_take_color(struct zone *zone, uint32_t color) {
+    uint32_t *link = &zone->zero_head;
+    while (*link != NO_BLOCK) {
+        uint32_t frame = *link;
+        if ((frame & (color_count - 1u)) == color) {
+            *link = page_array[frame].next;
+            zone->zero_count--;
+            zeroed_frame_count--;
+            return frame;
+        }
+        link = &page_array[frame].next;
+    }
+    return NO_BLOCK;
 }
 
-uintptr_t pmm_alloc_frame(void) {
-    for (uint32_t frame = 0; frame < frame_count; frame++) {
-        if (!frame_test(frame)) {
-            frame_set(frame);
-            if (free_frame_count > 0) {
-                free_frame_count--;
-            }
-            return (uintptr_t)frame * FRAME_SIZE;
+/* zone_alloc() for a single frame of one color, with the same watermark rules. */
+static uint32_t zone_alloc_color(uint32_t color, uint32_t flags) {
+    const uint8_t *list = zone_fallback[alloc_class(flags)];
+    for (uint32_t i = 0; list[i] != PMM_ZONE_COUNT; i++) {
+        struct zone *zone = &zones[list[i]];
+        if (!zone->free_frames || (i > 0 && zone->free_frames - 1u < zone->watermark_min)) {
+            continue;
+        }
+        uint32_t frame = buddy_alloc_color(zone, color);
+        if (frame != NO_BLOCK) {
+            return frame;
         }
     }
+    return NO_BLOCK;
+}
 
-    return 0;
+/*
+ * Single frame whose cache color matches `virt`, so that pages adjacent in a
+ * virtual range spread over the cache sets instead of colliding. Colored
+ * frames bypass the magazines, which hold frames of any color. When coloring
+ * is off, or no frame of the color is free, this is pmm_alloc_frames_flags(0).
+ */
+phys_addr_t pmm_alloc_frame_color(uintptr_t virt, uint32_t flags) {
+    if (!color_count) {
+        return pmm_alloc_frames_flags(0, flags);
+    }
+
+    uint32_t color = (uint32_t)(virt / FRAME_SIZE) & (color_count - 1u);
+    uint32_t irq_flags = irq_save();
+    uint32_t frame = NO_BLOCK;
+    int zeroed = 0;
+    if (flags & PMM_ALLOC_ZERO) {
+        frame = zero_pool_take_color(&zones[zone_fallback[alloc_class(flags)][0]], color);
+        zeroed = frame != NO_BLOCK;
+    }
+    if (frame == NO_BLOCK) {
+        frame = zone_alloc_color(color, flags);
+    }
+    if (frame != NO_BLOCK) {
+        color_hits++;
+        claim_frame(frame, 0, zeroed);
+    } else {
+        color_misses++;
+    }
+    irq_restore(irq_flags);
+
+    if (frame == NO_BLOCK) {
+        return pmm_alloc_frames_flags(0, flags);
+    }
+    if ((flags & PMM_ALLOC_ZERO) && !zeroed) {
+        zero_block(frame, 0);
+    }
+    return (phys_addr_t)frame * FRAME_SIZE;
 }
 
-uintptr_t pmm_alloc_frame_below(uintptr_t max_addr) {
-    if (max_addr == 0) {
-        return 0;
+/*
+ * Use `colors` page colors (rounded down to a power of two, capped at
+ * PMM_MAX_COLORS); 0 or 1 turns coloring off. Returns the count in effect.
+ */
+uint32_t pmm_set_colors(uint32_t colors) {
+    uint32_t applied = 1;
+    while (applied * 2u <= colors && applied < PMM_MAX_COLORS) {
+        applied *= 2u;
     }
+    color_count = applied > 1u ? applied : 0;
+    return color_count;
+}
+
+uint32_t pmm_colors(void) {
+    return color_count;
+}
 
-    uint32_t limit_frame = (uint32_t)(max_addr / FRAME_SIZE);
-    if (limit_frame > frame_count) {
-        limit_frame = frame_count;
+/*
+ * Colors of the L2 cache as reported by CPUID leaf 4 (or of the last data
+ * cache listed when there is no L2): the number of page-sized slices one cache
+ * way holds. Frames whose numbers agree modulo this count compete for the same
+ * sets. Returns 0 when the CPU does not describe its caches.
+ */
+uint32_t pmm_cache_colors(void) {
+    uint32_t regs[4];
+    cpu_cpuid(0, 0, regs);
+    if (regs[0] < 4u) {
+        return 0;
     }
 
-    for (uint32_t frame = 0; frame < limit_frame; frame++) {
-        if (!frame_test(frame)) {
-            frame_set(frame);
-            if (free_frame_count > 0) {
-                free_frame_count--;
-            }
-            return (uintptr_t)frame * FRAME_SIZE;
+    uint32_t colors = 0;
+    for (uint32_t index = 0; index < 8u; index++) {
+        cpu_cpuid(4, index, regs);
+        uint32_t type = regs[0] & 0x1Fu;
+        uint32_t level = (regs[0] >> 5) & 0x7u;
+        if (type == 0) {
+            break;
+        }
+        if (type == 2u) {
+            continue; /* instruction cache */
+        }
+        uint32_t partitions = ((regs[1] >> 12) & 0x3FFu) + 1u;
+        uint32_t line = (regs[1] & 0xFFFu) + 1u;
+        uint32_t sets = regs[2] + 1u;
+        colors = partitions * line * sets / FRAME_SIZE;
+        if (level == 2u) {
+            break;
         }
     }
+    return colors;
+}
 
-    return 0;
+void pmm_free_frame(phys_addr_t addr) {
+    pmm_free_frames(addr, 0);
 }
 
-void pmm_free_frame(uintptr_t addr) {
+void pmm_free_frames(phys_addr_t addr, uint32_t order) {
     uint32_t frame = (uint32_t)(addr / FRAME_SIZE);
-    if (frame >= frame_count) {
+    if (order > PMM_MAX_ORDER || frame >= frame_count) {
+        return;
+    }
+    if (frame & ((1u << order) - 1u)) {
+        kprintf("PMM: misaligned free of frame 0x%x (order %u)\n", frame, order);
+        return;
+    }
+
+    uint32_t irq_flags = irq_save();
+    struct page *page = &page_array[frame];
+    if (page->flags & PMM_PAGE_PINNED) {
+        irq_restore(irq_flags);
+        kprintf("PMM: refusing to free pinned frame 0x%x\n", frame);
         return;
     }
+    if (page->refcount == 0) {
+        irq_restore(irq_flags);
+        kprintf("PMM: double free of frame 0x%x (order %u)\n", frame, order);
+        return;
+    }
+    if (page->order != order) {
+        uint32_t allocated = page->order;
+        irq_restore(irq_flags);
+        kprintf("PMM: frame 0x%x freed as order %u, allocated as order %u\n", frame, order,
+                allocated);
+        return;
+    }
+    if (--page->refcount > 0) {
+        irq_restore(irq_flags); /* still mapped elsewhere */
+        return;
+    }
+    page->flags = 0;
+    page->owner = 0;
+
+    struct zone *zone = zone_of(frame);
+    if (order == 0) {
+        magazine_free(zone, frame);
+    } else {
+        buddy_free(zone, frame, order);
+    }
+    irq_restore(irq_flags);
+}
 
-    if (frame_test(frame)) {
-        frame_clear(frame);
-        free_frame_count++;
+/*
+ * Refill the zero pools a few frames at a time. Called on idle paths just
+ * before `hlt`, so the clearing cost is paid while the CPU would otherwise
+ * sleep. Frames are zeroed with interrupts enabled; zones under memory
+ * pressure (below their low watermark) are left alone.
+ */
+void pmm_idle_work(void) {
+    if (!page_array) {
+        return;
+    }
+
+    for (uint32_t n = 0; n < ZERO_IDLE_BATCH; n++) {
+        struct zone *zone = NULL;
+        uint32_t frame = NO_BLOCK;
+
+        uint32_t irq_flags = irq_save();
+        for (uint32_t z = PMM_ZONE_COUNT; z-- > 0;) {
+            struct zone *candidate = &zones[z];
+            if (candidate->zero_count < ZERO_POOL_TARGET &&
+                candidate->free_frames > candidate->watermark_low) {
+                zone = candidate;
+                frame = buddy_alloc(zone, 0);
+                break;
+            }
+        }
+        irq_restore(irq_flags);
+
+        if (frame == NO_BLOCK) {
+            return;
+        }
+
+        paging_zero_frame((phys_addr_t)frame * FRAME_SIZE);
+
+        irq_flags = irq_save();
+        zero_pool_push(zone, frame);
+        irq_restore(irq_flags);
+    }
+}
+
+struct page *pmm_page(phys_addr_t addr) {
+    uint32_t frame = (uint32_t)(addr / FRAME_SIZE);
+    if (!page_array || frame >= frame_count) {
+        return NULL;
+    }
+    return &page_array[frame];
+}
+
+void pmm_page_get(phys_addr_t addr) {
+    struct page *page = pmm_page(addr);
+    if (!page || page->refcount == 0) {
+        panic("PMM: reference taken on a free frame");
+    }
+    if (page->refcount == 0xFFFFu) {
+        panic("PMM: frame reference count overflow");
     }
+    uint32_t irq_flags = irq_save();
+    page->refcount++;
+    irq_restore(irq_flags);
 }
 
 uint32_t pmm_total_frames(void) {
     return frame_count;
 }
 
-uint32_t pmm_free_frames(void) {
-    return free_frame_count;
+uint32_t pmm_free_frame_count(void) {
+    return free_frame_count + cached_frame_count + zeroed_frame_count;
+}
+
+struct pmm_stats pmm_get_stats(void) {
+    struct pmm_stats stats;
+    stats.total_frames = frame_count;
+    stats.free_frames = free_frame_count + cached_frame_count + zeroed_frame_count;
+    for (uint32_t k = 0; k < PMM_ORDER_COUNT; k++) {
+        stats.order_free[k] = 0;
+    }
+    stats.colors = color_count;
+    stats.color_hits = color_hits;
+    stats.color_misses = color_misses;
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        const struct zone *zone = &zones[z];
+        struct pmm_zone_stats *out = &stats.zones[z];
+        out->name = zone->name;
+        out->base = (phys_addr_t)zone->start * FRAME_SIZE;
+        out->limit = (phys_addr_t)zone->end * FRAME_SIZE;
+        out->present_frames = zone->present_frames;
+        out->free_frames = zone->free_frames;
+        out->watermark_min = zone->watermark_min;
+        out->watermark_low = zone->watermark_low;
+        out->cached_frames = zone->magazine.count;
+        out->cache_hits = zone->magazine.hits;
+        out->cache_misses = zone->magazine.misses;
+        out->zeroed_frames = zone->zero_count;
+        out->zero_hits = zone->zero_hits;
+        out->zero_misses = zone->zero_misses;
+        for (uint32_t k = 0; k < PMM_ORDER_COUNT; k++) {
+            stats.order_free[k] += zone->areas[k].free_count;
+        }
+    }
+    return stats;
+}
+
+/*
+ * Boot-time microbenchmark: allocate every free frame, then free them all, and
+ * report the average cycle cost of each operation. Allocated frames are chained
+ * through their first word, so this must run before paging_init() while all
+ * physical memory below 4 GiB is still directly addressable.
+ */
+void pmm_benchmark(void) {
+    uint32_t free_before = pmm_free_frame_count();
+    uintptr_t chain = 0;
+    uint32_t count = 0;
+
+    uint64_t start = cpu_rdtsc();
+    for (;;) {
+        uintptr_t frame = pmm_alloc_frame();
+        if (!frame) {
+            break;
+        }
+        *(volatile uintptr_t *)frame = chain;
+        chain = frame;
+        count++;
+    }
+    uint64_t alloc_cycles = cpu_rdtsc() - start;
+
+    start = cpu_rdtsc();
+    while (chain) {
+        uintptr_t next = *(volatile uintptr_t *)chain;
+        pmm_free_frame(chain);
+        chain = next;
+    }
+    uint64_t free_cycles = cpu_rdtsc() - start;
+
+    kprintf("PMM bench: %u frames, alloc %u cycles/frame, free %u cycles/frame%s\n",
+            count, cpu_cycles_per(alloc_cycles, count), cpu_cycles_per(free_cycles, count),
+            pmm_free_frame_count() == free_before ? "" : " (free count mismatch!)");
+}
+
+/* Touch every cache line of each page in a chain, several rounds; cycles per line. */
+static uint32_t bench_touch_chain(uintptr_t chain) {
+    uint32_t lines = 0;
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t round = 0; round < BENCH_COLOR_ROUNDS; round++) {
+        for (uintptr_t page = chain; page; page = *(volatile uintptr_t *)page) {
+            for (uint32_t offset = 64u; offset < FRAME_SIZE; offset += 64u) {
+                (void)*(volatile uint32_t *)(page + offset);
+            }
+            lines += FRAME_SIZE / 64u - 1u;
+        }
+    }
+    return cpu_cycles_per(cpu_rdtsc() - start, lines);
+}
+
+static uintptr_t bench_alloc_chain(uint32_t pages, int colored) {
+    uintptr_t chain = 0;
+    for (uint32_t i = 0; i < pages; i++) {
+        uintptr_t frame = (uintptr_t)(colored ? pmm_alloc_frame_color((uintptr_t)i * FRAME_SIZE, PMM_ALLOC_IDENTITY)
+                                              : pmm_alloc_frames_flags(0, PMM_ALLOC_IDENTITY));
+        if (!frame) {
+            break;
+        }
+        *(volatile uintptr_t *)frame = chain;
+        chain = frame;
+    }
+    return chain;
+}
+
+static void bench_free_chain(uintptr_t chain) {
+    while (chain) {
+        uintptr_t next = *(volatile uintptr_t *)chain;
+        pmm_free_frame(chain);
+        chain = next;
+    }
+}
+
+/*
+ * Boot-time microbenchmark for page coloring. A working set the size of one
+ * cache is walked line by line, once in frames picked by the plain allocator
+ * and once in colored frames. Before the plain run, memory is fragmented by
+ * holding a pseudo-random half of a larger allocation, as long-running
+ * processes would, so the plain frames land at scattered colors and some sets
+ * overflow. Like pmm_benchmark(), this dereferences frames physically and must
+ * run before paging_init().
+ */
+void pmm_color_benchmark(void) {
+    uint32_t colors = pmm_cache_colors();
+    if (colors < 2u) {
+        kprintf("PMM color bench: cache geometry unknown, assuming 16 colors\n");
+        colors = 16u;
+    }
+    uint32_t previous = pmm_colors();
+    colors = pmm_set_colors(colors);
+    pmm_set_colors(previous);
+
+    uint32_t pages = colors * 8u; /* one cache's worth at 8 ways */
+    if (pages > BENCH_COLOR_MAX_PAGES) {
+        pages = BENCH_COLOR_MAX_PAGES;
+    }
+
+    uintptr_t scratch = bench_alloc_chain(pages * 4u, 0);
+    uintptr_t held = 0;
+    uint32_t seed = 0x2545F491u;
+    while (scratch) {
+        uintptr_t next = *(volatile uintptr_t *)scratch;
+        seed = seed * 1103515245u + 12345u;
+        if (seed & 0x10000u) {
+            *(volatile uintptr_t *)scratch = held;
+            held = scratch;
+        } else {
+            pmm_free_frame(scratch);
+        }
+        scratch = next;
+    }
+
+    uintptr_t plain = bench_alloc_chain(pages, 0);
+    uint32_t plain_cycles = bench_touch_chain(plain);
+    bench_free_chain(plain);
+
+    pmm_set_colors(colors);
+    uintptr_t colored = bench_alloc_chain(pages, 1);
+    uint32_t colored_cycles = bench_touch_chain(colored);
+    bench_free_chain(colored);
+    pmm_set_colors(previous);
+
+    bench_free_chain(held);
+    kprintf("PMM color bench: %u pages, %u colors, plain %u cycles/line, colored %u cycles/line\n",
+            pages, colors, plain_cycles, colored_cycles);
 }
@@ -5,49 +5,31 @@
 
 #include "osmosis/arch/i386/paging.h"
 #include "osmosis/arch/i386/segments.h"
+#include "osmosis/kmalloc.h"
 #include "osmosis/kprintf.h"
 #include "osmosis/pmm.h"
+#include "osmosis/shm.h"
+#include "osmosis/syscall_numbers.h"
 #include "osmosis/userland.h"
 #include "osmosis/vfs.h"
+#include "osmosis/vma.h"
 
-#define MAX_PROCESSES 8
+#define PF_PRESENT 0x1u /* page-fault error code: protection fault on a present page */
+#define PF_WRITE 0x2u   /* page-fault error code: the access was a write */
+#define USER_MMAP_BASE 0x40000000u /* mmap searches upward from here; brk stays below */
 #define USER_CODE (USER_CODE_SELECTOR | 0x03)
 #define USER_DATA (USER_DATA_SELECTOR | 0x03)
 
-static struct process processes[MAX_PROCESSES];
+static struct kmem_cache *process_cache = NULL;
+static struct process *processes = NULL; /* every live process, oldest first */
 static uint32_t next_pid = 1;
 static struct process *current = NULL;
 static uint32_t *kernel_directory = NULL;
 static void (*idle_callback)(void) = NULL;
+static struct process_stats stats;
 
-static struct process *alloc_process(const char *name) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i].state == PROCESS_UNUSED) {
-            struct process *p = &processes[i];
-            p->pid = next_pid++;
-            p->parent_pid = 0;
-            p->state = PROCESS_RUNNABLE;
-            p->exit_status = 0;
-            p->waiting_for = -1;
-            p->page_directory = NULL;
-            for (int c = 0; c < 32; c++) {
-                p->name[c] = 0;
-            }
-            if (name) {
-                int c = 0;
-                for (; c < 31 && name[c]; c++) {
-                    p->name[c] = name[c];
-                }
-                p->name[c] = 0;
-            }
-            return p;
-        }
-    }
-    return NULL;
-}
-
-static void setup_initial_context(struct process *p) {
-    struct isr_frame *ctx = &p->context;
+/* Zero a user context, then give it the user segments and interrupts enabled. */
+static void reset_context(struct isr_frame *ctx) {
     for (size_t i = 0; i < sizeof(*ctx) / sizeof(uint32_t); i++) {
         ((uint32_t *)ctx)[i] = 0;
     }
@@ -57,28 +39,92 @@ static void setup_initial_context(struct process *p) {
     ctx->gs = USER_DATA;
     ctx->ss = USER_DATA;
     ctx->cs = USER_CODE;
+    ctx->eflags = 0x202;
+}
+
+/*
+ * Cache constructor: a runnable process with no pid, name, address space or
+ * areas, waiting for nobody, whose context only lacks an entry point and a
+ * stack. Processes go back to the cache in this state.
+ */
+static void process_ctor(void *obj) {
+    struct process *p = obj;
+    for (size_t i = 0; i < sizeof(*p); i++) {
+        ((uint8_t *)p)[i] = 0;
+    }
+    p->state = PROCESS_RUNNABLE;
+    reset_context(&p->context);
+    vma_map_init(&p->image.vmas);
+    p->waiting_for = -1;
+}
+
+static struct process *alloc_process(const char *name) {
+    struct process *p = kmem_cache_alloc(process_cache);
+    if (!p) {
+        return NULL;
+    }
+    p->pid = next_pid++;
+    if (name) {
+        /* the constructed name is all zeros, so the copy stays terminated */
+        for (int c = 0; c < 31 && name[c]; c++) {
+            p->name[c] = name[c];
+        }
+    }
+
+    struct process **tail = &processes;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = p;
+    return p;
+}
+
+/* Start a reset context at the image's entry point and stack. */
+static void setup_initial_context(struct process *p) {
+    struct isr_frame *ctx = &p->context;
     ctx->eip = (uint32_t)p->image.entry;
     ctx->useresp = (uint32_t)p->image.stack_top;
-    ctx->eflags = 0x202;
 }
 
+/*
+ * Free a process and everything its address space holds. Releasing the
+ * current process (an exit reaped at once) leaves no current process, so
+ * the next schedule saves nothing.
+ */
+static void release_process(struct process *p) {
+    paging_destroy_address_space(p->page_directory);
+    vma_map_destroy(&p->image.vmas);
+    struct process **link = &processes;
+    while (*link != p) {
+        link = &(*link)->next;
+    }
+    *link = p->next;
+    if (p == current) {
+        current = NULL;
+    }
+    process_ctor(p);
+    kmem_cache_free(process_cache, p);
+}
+
+/* Round robin: the first runnable process after the current one, wrapping. */
 static struct process *find_runnable(void) {
-    int start = 0;
-    if (current) {
-        start = (int)(current - processes) + 1;
-    }
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        int idx = (start + i) % MAX_PROCESSES;
-        if (processes[idx].state == PROCESS_RUNNABLE) {
-            return &processes[idx];
+    struct process *start = current ? current->next : processes;
+    for (struct process *p = start; p; p = p->next) {
+        if (p->state == PROCESS_RUNNABLE) {
+            return p;
+        }
+    }
+    for (struct process *p = processes; p != start; p = p->next) {
+        if (p->state == PROCESS_RUNNABLE) {
+            return p;
         }
     }
     return NULL;
 }
 
 void process_init(void) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        processes[i].state = PROCESS_UNUSED;
+    if (!process_cache) {
+        process_cache = kmem_cache_create("process", sizeof(struct process), 0, process_ctor);
     }
     kernel_directory = paging_current_directory();
 }
@@ -90,21 +136,21 @@ void process_set_idle_callback(void (*cb)(void)) {
 int process_spawn_from_image(const uint8_t *image, uint32_t size, const char *name) {
     struct process *p = alloc_process(name);
     if (!p) {
-        kprintf("process: no free slots for %s\n", name ? name : "(anon)");
+        kprintf("process: out of memory for %s\n", name ? name : "(anon)");
         return -1;
     }
 
     p->page_directory = paging_create_address_space();
     if (!p->page_directory) {
         kprintf("process: failed to allocate page directory\n");
-        p->state = PROCESS_UNUSED;
+        release_process(p);
         return -1;
     }
 
     struct process_image img;
     if (!userland_load_elf_into(image, size, p->page_directory, &img)) {
         kprintf("process: ELF load failed for %s\n", name ? name : "(anon)");
-        p->state = PROCESS_UNUSED;
+        release_process(p);
         return -1;
     }
 
@@ -139,6 +185,9 @@ static void save_current(struct isr_frame *frame) {
 }
 
 static void enter_process(struct process *p, struct isr_frame *frame) {
+    if (p != current) {
+        stats.context_switches++;
+    }
     current = p;
     p->state = PROCESS_RUNNING;
     paging_switch_directory(p->page_directory);
@@ -158,12 +207,19 @@ int process_schedule(struct isr_frame *frame) {
 static __attribute__((noreturn)) void process_halt_forever(void) {
     kprintf("process: all user tasks exited\n");
     for (;;) {
+        pmm_idle_work();
         __asm__ __volatile__("hlt");
     }
 }
 
+/*
+ * Lazy TLB: kernel work after the last user task stops keeps running on
+ * whichever user directory is loaded. Every address space carries the kernel
+ * mappings, so switching to kernel_directory here would only cost a CR3 write
+ * and a TLB flush, and the next process switch replaces the directory anyway.
+ */
 void process_prepare_kernel_return(struct isr_frame *frame) {
-    paging_switch_directory(kernel_directory);
+    stats.lazy_kernel_returns++;
     frame->ds = KERNEL_DATA_SELECTOR;
     frame->es = KERNEL_DATA_SELECTOR;
     frame->fs = KERNEL_DATA_SELECTOR;
@@ -217,23 +273,32 @@ int process_sys_fork(struct isr_frame *frame) {
 
     struct process *child = alloc_process(current->name);
     if (!child) {
-        kprintf("fork: no process slot\n");
+        kprintf("fork: out of memory for a process\n");
         return -12;
     }
     child->parent_pid = current->pid;
     child->page_directory = paging_create_address_space();
     if (!child->page_directory) {
-        child->state = PROCESS_UNUSED;
+        release_process(child);
         return -12;
     }
 
-    if (!userland_clone_region(current->page_directory, child->page_directory,
-                               current->image.lowest, current->image.highest)) {
-        kprintf("fork: failed to clone region\n");
-        child->state = PROCESS_UNUSED;
+    child->image = current->image;
+    vma_map_init(&child->image.vmas);
+    if (!vma_map_clone(&child->image.vmas, &current->image.vmas)) {
+        release_process(child);
         return -12;
     }
-    child->image = current->image;
+    const struct vma_map *vmas = &current->image.vmas;
+    for (uint32_t i = 0; i < vmas->count; i++) {
+        if (!userland_clone_region(current->page_directory, child->page_directory,
+                                   vmas->areas[i].start, vmas->areas[i].end,
+                                   vmas->areas[i].kind == VMA_SHARED)) {
+            kprintf("fork: failed to clone region\n");
+            release_process(child);
+            return -12;
+        }
+    }
 
     child->context = *frame;
     child->context.eax = 0; /* child returns 0 */
@@ -249,15 +314,20 @@ void process_sys_exit(struct isr_frame *frame, int code) {
     current->exit_status = code;
     current->state = PROCESS_ZOMBIE;
     (void)frame;
+    /* The user half goes now; the directory itself waits for the reaper. */
+    paging_unmap_user(current->page_directory);
+    vma_map_destroy(&current->image.vmas);
 
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        struct process *p = &processes[i];
+    for (struct process *p = processes; p; p = p->next) {
         if (p->state == PROCESS_WAITING && p->waiting_for != 0 &&
             (p->waiting_for == -1 || p->waiting_for == (int)current->pid) &&
             p->pid == current->parent_pid) {
             p->context.eax = current->pid;
             p->state = PROCESS_RUNNABLE;
             p->waiting_for = -1;
+            /* The parent's waitpid returns this pid, so it is reaped here. */
+            release_process(current);
+            return;
         }
     }
 }
@@ -268,14 +338,13 @@ int process_sys_waitpid(struct isr_frame *frame, int pid) {
         return -1;
     }
     int found = 0;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        struct process *p = &processes[i];
+    for (struct process *p = processes; p; p = p->next) {
         if (p->state == PROCESS_ZOMBIE && (pid == -1 || (int)p->pid == pid) && p->parent_pid == current->pid) {
             int ret = (int)p->pid;
-            p->state = PROCESS_UNUSED;
+            release_process(p);
             return ret;
         }
-        if (p->state != PROCESS_UNUSED && p->parent_pid == current->pid) {
+        if (p->parent_pid == current->pid) {
             found = 1;
         }
     }
@@ -296,41 +365,234 @@ int process_sys_execve(struct isr_frame *frame, const char *path, const char *co
     if (!node) {
         return -2; /* ENOENT */
     }
+    if (!userland_elf_valid(node->data, node->size)) {
+        return -8; /* ENOEXEC */
+    }
+
+    /* Past this point the old image is gone, so a failed load ends the process. */
+    paging_unmap_user(current->page_directory);
     struct process_image img;
     if (!userland_load_elf_into(node->data, node->size, current->page_directory, &img)) {
+        kprintf("exec: failed to load %s\n", path);
+        process_sys_exit(frame, -8);
         return -8; /* ENOEXEC */
     }
+    vma_map_destroy(&current->image.vmas);
     current->image = img;
+    reset_context(&current->context);
     setup_initial_context(current);
     frame->eax = 0;
     enter_process(current, frame);
     return 0;
 }
 
+/*
+ * A user buffer is valid when areas granting user access cover all of it.
+ * Pages not populated yet are faulted in when the kernel touches them.
+ */
 int process_user_pointer_ok(uintptr_t ptr, uint32_t len) {
     if (!current) {
         return 0;
     }
-    if (len == 0) {
-        return 0;
+    return vma_range_ok(&current->image.vmas, ptr, len, PAGE_USER);
+}
+
+/*
+ * Page-fault entry for the running process, from user mode or from the
+ * kernel touching user memory: copy-on-write first, then the area map
+ * decides whether the page is populated or the fault is a real error. A hit
+ * on a stack guard page asks for the process to be killed.
+ */
+enum process_fault process_page_fault(uintptr_t addr, uint32_t error) {
+    if (paging_handle_fault(addr, error)) {
+        return PROCESS_FAULT_RESOLVED;
+    }
+    if (!current || current->state != PROCESS_RUNNING || (error & PF_PRESENT)) {
+        return PROCESS_FAULT_UNRESOLVED;
+    }
+    if (addr < PAGING_USER_BASE || addr >= PAGING_USER_LIMIT) {
+        return PROCESS_FAULT_UNRESOLVED;
+    }
+    struct vma_map *vmas = &current->image.vmas;
+    const struct vma *area = vma_find(vmas, addr);
+    if (!area) {
+        const struct vma *above = vma_find(vmas, addr + PAGE_SIZE);
+        if (above && above->kind == VMA_STACK && addr < above->start) {
+            kprintf("process %u: stack overflow at 0x%x\n", current->pid, (uint32_t)addr);
+            return PROCESS_FAULT_KILL;
+        }
+        return PROCESS_FAULT_UNRESOLVED;
     }
-    uintptr_t end = ptr + len - 1;
-    if (end < ptr) {
-        return 0;
+    if (!(area->prot & PAGE_USER) || ((error & PF_WRITE) && !(area->prot & PAGE_WRITE))) {
+        return PROCESS_FAULT_UNRESOLVED;
+    }
+    int write = (error & PF_WRITE) != 0;
+    if (!userland_fill_page(area, addr & ~(uintptr_t)(PAGE_SIZE - 1u), write)) {
+        return PROCESS_FAULT_UNRESOLVED;
     }
-    if (ptr < current->image.lowest || end > current->image.highest) {
+    if (area->kind == VMA_STACK) {
+        stats.stack_growths++;
+    } else if (area->kind == VMA_ANON && !write) {
+        stats.zero_maps++;
+    } else {
+        stats.demand_faults++;
+    }
+    return PROCESS_FAULT_RESOLVED;
+}
+
+static uintptr_t page_round_up(uintptr_t value) {
+    return (value + PAGE_SIZE - 1u) & ~(uintptr_t)(PAGE_SIZE - 1u);
+}
+
+static void release_user_frame(uintptr_t virt, phys_addr_t phys, void *ctx) {
+    (void)virt;
+    (void)ctx;
+    pmm_free_frame(phys);
+}
+
+/* Drop [start, end) from the current process: its areas, then its pages. */
+static int release_user_range(uintptr_t start, uintptr_t end) {
+    if (!vma_remove(&current->image.vmas, start, end)) {
+        return 0; /* the split needs an area slot */
+    }
+    paging_unmap_range(current->page_directory, start, (end - start) / PAGE_SIZE,
+                       release_user_frame, NULL);
+    return 1;
+}
+
+/*
+ * Move the break of the current process and return the new one, or the
+ * unchanged break if the request is out of range or cannot be met. The heap
+ * is an anonymous area, so growing it commits no memory.
+ */
+uintptr_t process_sys_brk(uintptr_t requested) {
+    if (!current) {
         return 0;
     }
-    return paging_range_has_flags(ptr, len, PAGE_USER);
+    struct process_image *img = &current->image;
+    if (!img->brk_start || requested < img->brk_start || requested > USER_MMAP_BASE) {
+        return img->brk;
+    }
+    uintptr_t old_end = page_round_up(img->brk);
+    uintptr_t new_end = page_round_up(requested);
+    if (new_end > old_end) {
+        struct vma area = {0};
+        area.start = old_end;
+        area.end = new_end;
+        area.prot = PAGE_USER | PAGE_WRITE;
+        area.kind = VMA_ANON;
+        if (!vma_insert(&img->vmas, &area)) {
+            return img->brk;
+        }
+    } else if (new_end < old_end && !release_user_range(new_end, old_end)) {
+        return img->brk;
+    }
+    img->brk = requested;
+    return img->brk;
+}
+
+/*
+ * Reserve a private anonymous mapping of `len` bytes and return its address,
+ * or a negative errno cast to uintptr_t. Pages are populated on first touch.
+ * `hint` is only where the search for a free range starts.
+ */
+uintptr_t process_sys_mmap(uintptr_t hint, uint32_t len, uint32_t prot, uint32_t flags) {
+    if (!current) {
+        return (uintptr_t)-22;
+    }
+    uint32_t known = OSMOSIS_PROT_READ | OSMOSIS_PROT_WRITE | OSMOSIS_PROT_EXEC;
+    if (len == 0 || (prot & ~known) || !(flags & OSMOSIS_MAP_PRIVATE) ||
+        !(flags & OSMOSIS_MAP_ANONYMOUS)) {
+        return (uintptr_t)-22; /* EINVAL */
+    }
+    if (len > PAGING_USER_LIMIT - USER_MMAP_BASE) {
+        return (uintptr_t)-12; /* ENOMEM */
+    }
+
+    struct vma area = {0};
+    area.end = page_round_up(len); /* size, until placed */
+    area.kind = VMA_ANON;
+    if (prot != OSMOSIS_PROT_NONE) {
+        area.prot = PAGE_USER | ((prot & OSMOSIS_PROT_WRITE) ? PAGE_WRITE : 0);
+    }
+
+    struct vma_map *vmas = &current->image.vmas;
+    uintptr_t start = 0;
+    if (hint >= USER_MMAP_BASE && hint < PAGING_USER_LIMIT) {
+        start = vma_find_gap(vmas, hint & ~(uintptr_t)(PAGE_SIZE - 1u), PAGING_USER_LIMIT,
+                             (uint32_t)area.end);
+    }
+    if (!start) {
+        start = vma_find_gap(vmas, USER_MMAP_BASE, PAGING_USER_LIMIT, (uint32_t)area.end);
+    }
+    if (!start) {
+        return (uintptr_t)-12;
+    }
+    area.start = start;
+    area.end += start;
+    if (!vma_insert(vmas, &area)) {
+        return (uintptr_t)-12; /* no memory for the area */
+    }
+    return start;
+}
+
+/* Remove [addr, addr + len) from the current process, mapped or not. */
+int process_sys_munmap(uintptr_t addr, uint32_t len) {
+    if (!current) {
+        return -22;
+    }
+    if (len == 0 || (addr & (PAGE_SIZE - 1u)) || addr < PAGING_USER_BASE ||
+        addr >= PAGING_USER_LIMIT || len > PAGING_USER_LIMIT - addr) {
+        return -22; /* EINVAL */
+    }
+    if (!release_user_range(addr, page_round_up(addr + len))) {
+        return -12; /* ENOMEM */
+    }
+    return 0;
+}
+
+/*
+ * Map shared-memory segment `id` into the current process and return its
+ * address, or a negative errno cast to uintptr_t. The pages are the
+ * segment's own frames, so writes are seen by every process that maps it.
+ */
+uintptr_t process_sys_shm_map(int id, uint32_t prot) {
+    if (!current) {
+        return (uintptr_t)-22;
+    }
+    uint32_t pages = shm_pages(id);
+    uint32_t known = OSMOSIS_PROT_READ | OSMOSIS_PROT_WRITE | OSMOSIS_PROT_EXEC;
+    if (!pages || prot == OSMOSIS_PROT_NONE || (prot & ~known)) {
+        return (uintptr_t)-22; /* EINVAL */
+    }
+
+    struct vma_map *vmas = &current->image.vmas;
+    uintptr_t start = vma_find_gap(vmas, USER_MMAP_BASE, PAGING_USER_LIMIT, pages * PAGE_SIZE);
+    if (!start) {
+        return (uintptr_t)-12; /* ENOMEM */
+    }
+    struct vma area = {0};
+    area.start = start;
+    area.end = start + pages * PAGE_SIZE;
+    area.prot = PAGE_USER | ((prot & OSMOSIS_PROT_WRITE) ? PAGE_WRITE : 0);
+    area.kind = VMA_SHARED;
+    if (!vma_insert(vmas, &area)) {
+        return (uintptr_t)-12;
+    }
+    if (!shm_map_into(id, current->page_directory, start, area.prot)) {
+        release_user_range(area.start, area.end);
+        return (uintptr_t)-12;
+    }
+    return start;
+}
+
+struct process_stats process_get_stats(void) {
+    return stats;
 }
 
 void process_list(void) {
-    kprintf("PID  PPID  STATE     NAME\n");
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        const struct process *p = &processes[i];
-        if (p->state == PROCESS_UNUSED) {
-            continue;
-        }
+    kprintf("PID  PPID  STATE    AREAS NAME\n");
+    for (const struct process *p = processes; p; p = p->next) {
         const char *state = "unk";
         switch (p->state) {
             case PROCESS_RUNNABLE:
@@ -349,6 +611,11 @@ void process_list(void) {
                 state = "unk";
                 break;
         }
-        kprintf("%-4u %-5u %-8s %s\n", p->pid, p->parent_pid, state, p->name);
+        kprintf("%-4u %-5u %-8s %-5u %s\n", p->pid, p->parent_pid, state, p->image.vmas.count,
+                p->name);
     }
+    kprintf("context switches=%u lazy kernel returns=%u\n", stats.context_switches,
+            stats.lazy_kernel_returns);
+    kprintf("demand faults=%u stack growths=%u zero-page maps=%u\n", stats.demand_faults,
+            stats.stack_growths, stats.zero_maps);
 }
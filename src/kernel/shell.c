@@ -7,8 +7,10 @@
 #include "osmosis/kmalloc.h"
 #include "osmosis/pmm.h"
 #include "osmosis/process.h"
+#include "osmosis/shm.h"
 #include "osmosis/tty.h"
 #include "osmosis/vfs.h"
+#include "osmosis/vmalloc.h"
 #include "osmosis/arch/i386/keyboard.h"
 #include "osmosis/arch/i386/paging.h"
 #include "osmosis/arch/i386/pit.h"
@@ -41,8 +43,12 @@ static void shell_print_help(void) {
     tty_write("  paging       - Show paging status\n");
     tty_write("  heap         - Show heap allocator statistics\n");
     tty_write("  alloc_test   - Allocate and free test blocks\n");
+    tty_write("  slabinfo     - Show object cache statistics\n");
     tty_write("  sleep <ms>   - Pause for the requested milliseconds\n");
+    tty_write("  colors <n>   - Set page colors (0=off, auto=from cache)\n");
     tty_write("  ps           - List processes\n");
+    tty_write("  shm          - List shared-memory segments\n");
+    tty_write("  vmalloc      - List vmalloc areas\n");
     tty_write("  ls           - List initramfs files\n");
     tty_write("  cat <path>   - Print an initramfs file\n");
 }
@@ -54,7 +60,7 @@ static void shell_print_info(void) {
         freq = 100;
     }
     kprintf("OS/mosis kernel: v0.1 (ticks=%u @ %u Hz, free_frames=%u)\n",
-            ticks, freq, pmm_free_frames());
+            ticks, freq, pmm_free_frame_count());
     kprintf("Console: VGA text, IRQs enabled, PS/2 keyboard buffered, PIT %u Hz.\n", freq);
 }
 
@@ -66,22 +72,52 @@ static void shell_print_ticks(void) {
 }
 
 static void shell_print_memory(void) {
-    uint32_t total_frames = pmm_total_frames();
-    uint32_t free_frames = pmm_free_frames();
+    struct pmm_stats stats = pmm_get_stats();
     kprintf("Physical memory: total=%u KiB free=%u KiB (%u/%u frames free)\n",
-            (total_frames * 4), (free_frames * 4), free_frames, total_frames);
+            (stats.total_frames * 4), (stats.free_frames * 4),
+            stats.free_frames, stats.total_frames);
+    for (uint32_t z = 0; z < PMM_ZONE_COUNT; z++) {
+        const struct pmm_zone_stats *zone = &stats.zones[z];
+        kprintf("  zone %s [%u MiB, %u MiB) free=%u/%u frames min=%u low=%u%s\n",
+                zone->name, (uint32_t)(zone->base >> 20), (uint32_t)(zone->limit >> 20),
+                zone->free_frames, zone->present_frames,
+                zone->watermark_min, zone->watermark_low,
+                zone->free_frames < zone->watermark_low ? " (low)" : "");
+        kprintf("    magazine: cached=%u hits=%u misses=%u\n",
+                zone->cached_frames, zone->cache_hits, zone->cache_misses);
+        kprintf("    zero pool: ready=%u hits=%u misses=%u\n",
+                zone->zeroed_frames, zone->zero_hits, zone->zero_misses);
+    }
+    if (stats.colors) {
+        kprintf("Page coloring: %u colors, hits=%u misses=%u\n",
+                stats.colors, stats.color_hits, stats.color_misses);
+    } else {
+        kprintf("Page coloring: off\n");
+    }
+    kprintf("Free blocks by order:");
+    for (uint32_t order = 0; order < PMM_ORDER_COUNT; order++) {
+        kprintf(" %u:%u", order, stats.order_free[order]);
+    }
+    kprintf("\n");
 }
 
 static void shell_print_paging(void) {
     struct paging_stats stats = paging_get_stats();
-    kprintf("Paging: %s (CR3=0x%x)\n",
-            stats.enabled ? "enabled" : "disabled",
+    kprintf("Paging: %s, %s tables (CR3=0x%x)\n",
+            stats.enabled ? "enabled" : "disabled", stats.pae ? "PAE" : "32-bit",
             (uint32_t)stats.page_directory_phys);
-    kprintf("Identity map: [0x%x, 0x%x) mapped_pages=%u tables=%u\n",
+    kprintf("Identity map: [0x%x, 0x%x) tables=%u\n",
             (uint32_t)stats.identity_base,
             (uint32_t)stats.identity_limit,
-            stats.mapped_pages,
             stats.page_table_count);
+    kprintf("Mappings: large=%u (%u KiB each) small=%u\n",
+            stats.large_pages, stats.large_page_size / 1024u, stats.mapped_pages);
+    kprintf("TLB: global kernel pages %s, CR3 loads=%u skipped=%u\n",
+            stats.global_pages ? "on" : "off", stats.cr3_loads, stats.cr3_skips);
+    kprintf("TLB flushes: invlpg=%u full=%u\n", stats.tlb_single_flushes, stats.tlb_full_flushes);
+    kprintf("kmap: %u slots, peak %u in use\n", stats.kmap_slots, stats.kmap_peak);
+    kprintf("Copy-on-write faults: copied=%u reused=%u zero-filled=%u\n", stats.cow_copies,
+            stats.cow_reuses, stats.zero_fills);
 }
 
 static void shell_print_heap(void) {
@@ -90,55 +126,88 @@ static void shell_print_heap(void) {
             (uint32_t)stats.heap_base, (uint32_t)stats.heap_limit,
             (uint32_t)stats.heap_top, (uint32_t)stats.mapped_bytes,
             (uint32_t)stats.free_bytes);
-    kprintf("Allocations: total=%u frees=%u\n",
-            stats.total_allocs, stats.total_frees);
+    kprintf("Free pages: cached=%u bytes trimmed=%u pages\n", (uint32_t)stats.cached_bytes,
+            stats.trimmed_pages);
+    kprintf("Allocations: total=%u frees=%u bad frees=%u large=%u bytes\n",
+            stats.total_allocs, stats.total_frees, stats.bad_frees,
+            (uint32_t)stats.large_bytes);
+    kprintf("CLASS  ACTIVE  SLABS  WASTED\n");
+    for (uint32_t i = 0; i < KMALLOC_CLASS_COUNT; i++) {
+        struct kmalloc_class_stats cls;
+        if (kmalloc_get_class_stats(i, &cls) && cls.slabs) {
+            kprintf("%5u  %6u  %5u  %6u\n", cls.size, cls.active, cls.slabs, cls.wasted);
+        }
+    }
 }
 
-static void shell_alloc_test(void) {
-    kprintf("Running heap allocation test...\n");
-    void *a = kmalloc(64);
-    void *b = kmalloc(128);
-    void *c = kmalloc(32);
-
-    if (!a || !b || !c) {
-        kprintf("Allocation failure (a=%p b=%p c=%p)\n", a, b, c);
-        return;
+/* Every kmem cache, then the kmalloc size classes. */
+static void shell_print_slabinfo(void) {
+    kprintf("ACTIVE  TOTAL  SIZE  STRIDE  SLABS    ALLOCS     CTORS  NAME\n");
+    struct kmem_cache_stats cache;
+    for (uint32_t i = 0; kmem_cache_get_stats(i, &cache); i++) {
+        kprintf("%6u  %5u  %4u  %6u  %5u  %8u  %8u  %s\n", cache.active,
+                cache.slabs * cache.per_slab, cache.size, cache.stride, cache.slabs,
+                cache.allocs, cache.ctor_calls, cache.name);
     }
+}
 
-    /* Touch memory to ensure mapping. */
-    uint8_t *pa = (uint8_t *)a;
-    uint8_t *pb = (uint8_t *)b;
-    uint8_t *pc = (uint8_t *)c;
-    for (int i = 0; i < 64; i++) {
-        pa[i] = (uint8_t)i;
-    }
-    for (int i = 0; i < 128; i++) {
-        pb[i] = (uint8_t)(i + 1);
+#define ALLOC_TEST_BLOCKS 96
+
+/*
+ * Fragmentation stress: fill the heap with a mix of slab-sized and
+ * page-sized blocks, free every other one, then the rest. With coalescing,
+ * the largest free block afterwards is back to what it was before.
+ */
+static void shell_alloc_test(void) {
+    static const uint32_t sizes[] = {40, 3000, 200, 9000, 1500, 17000, 64, 6000};
+    static uint8_t *blocks[ALLOC_TEST_BLOCKS];
+    const uint32_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    /* Give each size class its cached empty slab first, so it does not count as a leak. */
+    for (uint32_t i = 0; i < size_count; i++) {
+        kfree(kmalloc(sizes[i]));
     }
-    for (int i = 0; i < 32; i++) {
-        pc[i] = 0xAA;
+    uint32_t before = (uint32_t)kmalloc_get_stats().largest_free;
+    kprintf("Running heap fragmentation test (largest free block %u bytes)...\n", before);
+
+    uint32_t allocated = 0;
+    for (uint32_t i = 0; i < ALLOC_TEST_BLOCKS; i++) {
+        uint32_t size = sizes[i % size_count];
+        blocks[i] = kmalloc(size);
+        if (!blocks[i]) {
+            continue;
+        }
+        allocated++;
+        for (uint32_t b = 0; b < size; b++) {
+            blocks[i][b] = (uint8_t)(i + b);
+        }
     }
 
-    /* Verify a small sample. */
     int ok = 1;
-    for (int i = 0; i < 64; i++) {
-        if (pa[i] != (uint8_t)i) {
-            ok = 0;
-            break;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = (uint32_t)pass; i < ALLOC_TEST_BLOCKS; i += 2) {
+            if (!blocks[i]) {
+                continue;
+            }
+            uint32_t size = sizes[i % size_count];
+            if (blocks[i][0] != (uint8_t)i || blocks[i][size - 1u] != (uint8_t)(i + size - 1u)) {
+                ok = 0;
+            }
+            kfree(blocks[i]);
+            blocks[i] = NULL;
+        }
+        if (pass == 0) {
+            kprintf("  half freed: largest free block %u bytes\n",
+                    (uint32_t)kmalloc_get_stats().largest_free);
         }
     }
-    if (ok && pb[5] != 6) {
-        ok = 0;
-    }
-    if (ok && pc[10] != 0xAA) {
+
+    uint32_t after = (uint32_t)kmalloc_get_stats().largest_free;
+    if (allocated < ALLOC_TEST_BLOCKS || after < before) {
         ok = 0;
     }
-
-    kfree(a);
-    kfree(b);
-    kfree(c);
-
-    kprintf("Heap test %s (a=%p b=%p c=%p)\n", ok ? "passed" : "failed", a, b, c);
+    kprintf("Heap test %s: %u/%u blocks, largest free block %u -> %u bytes\n",
+            ok ? "passed" : "failed", allocated, ALLOC_TEST_BLOCKS, before, after);
 }
 
 static void shell_print_uptime(void) {
@@ -236,8 +305,14 @@ static void shell_handle_line(const char *line) {
         shell_print_heap();
     } else if (str_eq(line, "alloc_test")) {
         shell_alloc_test();
+    } else if (str_eq(line, "slabinfo")) {
+        shell_print_slabinfo();
     } else if (str_eq(line, "ps")) {
         process_list();
+    } else if (str_eq(line, "shm")) {
+        shm_list();
+    } else if (str_eq(line, "vmalloc")) {
+        vmalloc_list();
     } else if (str_eq(line, "ls")) {
         vfs_list();
     } else {
@@ -250,6 +325,20 @@ static void shell_handle_line(const char *line) {
             } else {
                 kprintf("Invalid duration: %s\n", arg);
             }
+        } else if (match_command(line, "colors", &arg) && arg && *arg) {
+            uint32_t colors;
+            if (str_eq(arg, "auto")) {
+                colors = pmm_cache_colors();
+            } else if (!parse_uint(arg, &colors)) {
+                kprintf("Invalid color count: %s\n", arg);
+                return;
+            }
+            colors = pmm_set_colors(colors);
+            if (colors) {
+                kprintf("Page coloring: %u colors\n", colors);
+            } else {
+                kprintf("Page coloring: off\n");
+            }
         } else if (match_command(line, "cat", &arg) && arg && *arg) {
             const struct vfs_node *node = vfs_lookup(arg);
             if (!node) {
@@ -288,6 +377,7 @@ void shell_run(void) {
     for (;;) {
         char c;
         if (!keyboard_buffer_read(&c)) {
+            pmm_idle_work();
             __asm__ __volatile__("hlt");
             continue;
         }
@@ -0,0 +1,149 @@
+#include "osmosis/shm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osmosis/arch/i386/paging.h"
+#include "osmosis/kmalloc.h"
+#include "osmosis/kprintf.h"
+#include "osmosis/pmm.h"
+
+/*
+ * A named run of frames that several address spaces map at once. The
+ * segment holds one reference per frame while its name exists and every
+ * mapping holds another, so the frames go back to the PMM only when the
+ * name is unlinked and the last mapping is gone, whichever comes last.
+ */
+struct shm_segment {
+    int used;
+    uint32_t key;
+    uint32_t pages;
+    phys_addr_t *frames;
+};
+
+static struct shm_segment segments[SHM_MAX_SEGMENTS];
+static uint32_t attaches = 0;
+
+static struct shm_segment *segment_of(int id) {
+    if (id < 0 || id >= SHM_MAX_SEGMENTS || !segments[id].used) {
+        return NULL;
+    }
+    return &segments[id];
+}
+
+static void drop_frames(struct shm_segment *seg, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        pmm_free_frame(seg->frames[i]);
+    }
+    kfree(seg->frames);
+    seg->frames = NULL;
+    seg->used = 0;
+}
+
+/*
+ * Open the segment named `key`, creating it with `size` bytes (whole zeroed
+ * pages, allocated now) when no such segment exists. A size of 0 only opens.
+ * Returns the segment id or a negative errno.
+ */
+int shm_open(uint32_t key, uint32_t size) {
+    int free_slot = -1;
+    for (int i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        if (segments[i].used && segments[i].key == key) {
+            if (size > segments[i].pages * PAGE_SIZE) {
+                return -22; /* EINVAL: exists, smaller */
+            }
+            return i;
+        }
+        if (!segments[i].used && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (size == 0 || size > SHM_MAX_PAGES * PAGE_SIZE) {
+        return size ? -22 : -2; /* EINVAL, or ENOENT for a plain open */
+    }
+    if (free_slot < 0) {
+        return -28; /* ENOSPC */
+    }
+
+    struct shm_segment *seg = &segments[free_slot];
+    seg->pages = (size + PAGE_SIZE - 1u) / PAGE_SIZE;
+    seg->frames = kmalloc(seg->pages * sizeof(phys_addr_t));
+    if (!seg->frames) {
+        return -12; /* ENOMEM */
+    }
+    seg->used = 1;
+    seg->key = key;
+    for (uint32_t i = 0; i < seg->pages; i++) {
+        /* Colour by offset: mappings are page-aligned, so colours follow. */
+        seg->frames[i] = pmm_alloc_frame_color(i * PAGE_SIZE, PMM_ALLOC_ZERO | PMM_ALLOC_EXTENDED);
+        if (!seg->frames[i]) {
+            drop_frames(seg, i);
+            return -12;
+        }
+    }
+    return free_slot;
+}
+
+/* Size of segment `id` in pages, or 0 if there is no such segment. */
+uint32_t shm_pages(int id) {
+    struct shm_segment *seg = segment_of(id);
+    return seg ? seg->pages : 0;
+}
+
+/*
+ * Map all of segment `id` at `virt` in `directory`, each page taking a frame
+ * reference. Returns 0 if a page could not be mapped; the pages mapped so
+ * far are left for the caller to unmap.
+ */
+int shm_map_into(int id, uint32_t *directory, uintptr_t virt, uint32_t flags) {
+    struct shm_segment *seg = segment_of(id);
+    if (!seg) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < seg->pages; i++) {
+        if (!paging_map_in(directory, virt + i * PAGE_SIZE, seg->frames[i], flags)) {
+            return 0;
+        }
+        pmm_page_get(seg->frames[i]);
+    }
+    attaches++;
+    return 1;
+}
+
+/* Remove the name; the frames live on until their last mapping goes. */
+int shm_unlink(int id) {
+    struct shm_segment *seg = segment_of(id);
+    if (!seg) {
+        return -22;
+    }
+    drop_frames(seg, seg->pages);
+    return 0;
+}
+
+void shm_list(void) {
+    kprintf("ID  KEY         PAGES  MAPPINGS\n");
+    for (int i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        const struct shm_segment *seg = &segments[i];
+        if (!seg->used) {
+            continue;
+        }
+        /* Every mapping of the first page is a mapping of the segment. */
+        uint32_t mappings = pmm_page(seg->frames[0])->refcount - 1u;
+        kprintf("%2d  0x%08x  %5u  %u\n", i, seg->key, seg->pages, mappings);
+    }
+    kprintf("attaches since boot=%u\n", attaches);
+}
+
+struct shm_stats shm_get_stats(void) {
+    struct shm_stats stats;
+    stats.segments = 0;
+    stats.pages = 0;
+    for (int i = 0; i < SHM_MAX_SEGMENTS; i++) {
+        if (segments[i].used) {
+            stats.segments++;
+            stats.pages += segments[i].pages;
+        }
+    }
+    stats.attaches = attaches;
+    return stats;
+}
@@ -5,13 +5,18 @@
 #include "osmosis/kprintf.h"
 #include "osmosis/pmm.h"
 #include "osmosis/process.h"
+#include "osmosis/vma.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
-#define USER_ELF_BASE 0x4000000u
-#define USER_STACK_TOP 0x4100000u
-#define USER_STACK_SIZE (16u * PAGE_SIZE)
+#define USER_ELF_BASE PAGING_USER_BASE
+#define USER_STACK_TOP PAGING_USER_LIMIT /* leaves the middle of the user half to brk and mmap */
+#ifndef CONFIG_USER_STACK_PAGES
+#define CONFIG_USER_STACK_PAGES 32u /* stack area size; processes start with one page mapped */
+#endif
+#define USER_STACK_LIMIT (USER_STACK_TOP - CONFIG_USER_STACK_PAGES * PAGE_SIZE)
+#define USER_STACK_GUARD (USER_STACK_LIMIT - PAGE_SIZE) /* never mapped */
 #define USER_PID 1u
 
 struct user_program {
@@ -20,6 +25,7 @@ struct user_program {
     uintptr_t highest;
     uintptr_t stack_top;
     uintptr_t stack_base;
+    struct vma_map *vmas; /* when set, record areas for demand paging instead of mapping */
 };
 
 struct elf32_ehdr {
@@ -64,6 +70,8 @@ static struct {
 
 extern const uint8_t _binary_build_user_hello_user_elf_start[];
 extern const uint8_t _binary_build_user_hello_user_elf_end[];
+extern const uint8_t _binary_build_user_forkbench_elf_start[];
+extern const uint8_t _binary_build_user_forkbench_elf_end[];
 
 static uintptr_t align_up(uintptr_t value, uintptr_t align) {
     return (value + align - 1u) & ~(align - 1u);
@@ -73,35 +81,152 @@ static uintptr_t align_down(uintptr_t value, uintptr_t align) {
     return value & ~(align - 1u);
 }
 
-static int map_page(uintptr_t virt, uint32_t flags) {
-    uintptr_t frame = pmm_alloc_frame();
-    if (!frame) {
-        kprintf("userland: frame allocation failed for 0x%x\n", (uint32_t)virt);
+static phys_addr_t user_frame(uintptr_t virt, void *ctx) {
+    (void)ctx;
+    /* Zeroed frames avoid leaking data; the PMM usually has them pre-cleared. */
+    return pmm_alloc_frame_color(virt, PMM_ALLOC_ZERO | PMM_ALLOC_EXTENDED);
+}
+
+static void release_user_frame(uintptr_t virt, phys_addr_t phys, void *ctx) {
+    (void)virt;
+    (void)ctx;
+    pmm_free_frame(phys);
+}
+
+/* Back [start, end) with fresh zeroed frames, or map nothing at all. */
+static int map_pages(uintptr_t start, uintptr_t end, uint32_t flags) {
+    uint32_t *directory = paging_current_directory();
+    size_t pages = (end - start) / PAGE_SIZE;
+    size_t mapped = paging_map_range(directory, start, pages, flags, user_frame, NULL);
+    if (mapped == pages) {
+        return 1;
+    }
+
+    uintptr_t failed = start + mapped * PAGE_SIZE;
+    if (paging_resolve(failed)) {
+        kprintf("userland: 0x%x is already mapped\n", (uint32_t)failed);
+    } else {
+        kprintf("userland: mapping failed for 0x%x\n", (uint32_t)failed);
+    }
+    paging_unmap_range(directory, start, mapped, release_user_frame, NULL);
+    return 0;
+}
+
+static int segment_ok(const struct elf32_phdr *ph, uint32_t image_size) {
+    if (ph->p_vaddr < USER_ELF_BASE) {
+        kprintf("userland: segment below user base: 0x%x\n", ph->p_vaddr);
         return 0;
     }
-    if (!paging_map(virt, frame, flags)) {
-        kprintf("userland: mapping failed for 0x%x -> 0x%x\n", (uint32_t)virt, (uint32_t)frame);
+    if (ph->p_vaddr >= PAGING_USER_LIMIT || ph->p_memsz > PAGING_USER_LIMIT - ph->p_vaddr) {
+        kprintf("userland: segment above user limit: 0x%x\n", ph->p_vaddr);
         return 0;
     }
-    /* Zero the page to avoid leaking data. */
-    uint8_t *dest = (uint8_t *)(virt & ~(PAGE_SIZE - 1u));
-    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
-        dest[i] = 0;
+    if (ph->p_offset > image_size || ph->p_filesz > image_size - ph->p_offset) {
+        kprintf("userland: segment overruns image (off=0x%x size=0x%x image=0x%x)\n",
+                ph->p_offset, ph->p_filesz, image_size);
+        return 0;
+    }
+    if (ph->p_filesz > ph->p_memsz) {
+        kprintf("userland: segment file size exceeds memory size at 0x%x\n", ph->p_vaddr);
+        return 0;
+    }
+    if (ph->p_vaddr < USER_STACK_TOP && ph->p_vaddr + ph->p_memsz > USER_STACK_GUARD) {
+        kprintf("userland: segment overlaps the stack reservation: 0x%x\n", ph->p_vaddr);
+        return 0;
     }
     return 1;
 }
 
-static int map_segment(const struct elf32_phdr *ph, const uint8_t *image, uint32_t image_size, struct user_program *prog) {
-    if (ph->p_type != PT_LOAD) {
+/* Eager load for the boot demo, which runs outside the process model. */
+static int copy_segment(const struct elf32_phdr *ph, const uint8_t *image, uintptr_t seg_start,
+                        uintptr_t seg_end, uint32_t flags) {
+    /* Mapped writable for the copy: the kernel honours read-only pages (CR0.WP). */
+    if (!map_pages(seg_start, seg_end, flags | PAGE_WRITE)) {
+        return 0;
+    }
+
+    /* Pages arrive zeroed, so only the file-backed bytes need copying. */
+    uint8_t *dest = (uint8_t *)(uintptr_t)ph->p_vaddr;
+    for (uint32_t i = 0; i < ph->p_filesz; i++) {
+        dest[i] = image[ph->p_offset + i];
+    }
+    if (!(flags & PAGE_WRITE)) {
+        paging_protect_range(paging_current_directory(), seg_start,
+                             (seg_end - seg_start) / PAGE_SIZE, flags);
+    }
+    return 1;
+}
+
+/*
+ * `page` already belongs to a segment recorded earlier: cut it into an area
+ * of its own that takes this segment's bytes too, with the union of both
+ * segments' permissions.
+ */
+static int share_page(struct vma_map *map, uintptr_t page, const uint8_t *image,
+                      const struct vma_file_range *range, uint32_t flags) {
+    struct vma *area = vma_find(map, page);
+    if (area->kind != VMA_FILE || area->file != image || area->file_ranges == VMA_FILE_RANGES) {
+        return 0;
+    }
+    if (!vma_split(map, page) || !vma_split(map, page + PAGE_SIZE)) {
+        return 0;
+    }
+    area = vma_find(map, page);
+    area->files[area->file_ranges++] = *range;
+    area->prot |= flags;
+    return 1;
+}
+
+/*
+ * Record a segment as a file-backed area for the page-fault handler; nothing
+ * is mapped yet. Its first or last page may be shared with a segment
+ * recorded earlier, as when a linker packs text and data into one page.
+ */
+static int record_pages(const struct elf32_phdr *ph, const uint8_t *image, uintptr_t seg_start,
+                        uintptr_t seg_end, uint32_t flags, struct vma_map *map) {
+    struct vma_file_range range = {ph->p_vaddr, ph->p_offset, ph->p_filesz};
+    if (vma_find(map, seg_start)) {
+        if (!share_page(map, seg_start, image, &range, flags)) {
+            return 0;
+        }
+        seg_start += PAGE_SIZE;
+    }
+    if (seg_start < seg_end && vma_find(map, seg_end - PAGE_SIZE)) {
+        if (!share_page(map, seg_end - PAGE_SIZE, image, &range, flags)) {
+            return 0;
+        }
+        seg_end -= PAGE_SIZE;
+    }
+    if (seg_start == seg_end) {
         return 1;
     }
-    if (ph->p_vaddr < USER_ELF_BASE) {
-        kprintf("userland: segment below user base: 0x%x\n", ph->p_vaddr);
+
+    struct vma area = {0};
+    area.start = seg_start;
+    area.end = seg_end;
+    area.prot = flags;
+    area.kind = VMA_FILE;
+    area.file = image;
+    area.file_ranges = 1;
+    area.files[0] = range;
+    return vma_insert(map, &area);
+}
+
+static int record_segment(const struct elf32_phdr *ph, const uint8_t *image, uintptr_t seg_start,
+                          uintptr_t seg_end, uint32_t flags, struct user_program *prog) {
+    if (!record_pages(ph, image, seg_start, seg_end, flags, prog->vmas)) {
+        kprintf("userland: segment at 0x%x overlaps another or no memory for its area\n",
+                ph->p_vaddr);
         return 0;
     }
-    if (ph->p_offset + ph->p_filesz > image_size) {
-        kprintf("userland: segment overruns image (off=0x%x size=0x%x image=0x%x)\n",
-                ph->p_offset, ph->p_filesz, image_size);
+    return 1;
+}
+
+static int map_segment(const struct elf32_phdr *ph, const uint8_t *image, uint32_t image_size, struct user_program *prog) {
+    if (ph->p_type != PT_LOAD) {
+        return 1;
+    }
+    if (!segment_ok(ph, image_size)) {
         return 0;
     }
 
@@ -109,18 +234,12 @@ static int map_segment(const struct elf32_phdr *ph, const uint8_t *image, uint32
     uintptr_t seg_end = align_up(ph->p_vaddr + ph->p_memsz, PAGE_SIZE);
     uint32_t flags = PAGE_USER | ((ph->p_flags & PF_W) ? PAGE_WRITE : 0);
 
-    for (uintptr_t addr = seg_start; addr < seg_end; addr += PAGE_SIZE) {
-        if (!map_page(addr, flags)) {
+    if (prog->vmas) {
+        if (!record_segment(ph, image, seg_start, seg_end, flags, prog)) {
             return 0;
         }
-    }
-
-    uint8_t *dest = (uint8_t *)(uintptr_t)ph->p_vaddr;
-    for (uint32_t i = 0; i < ph->p_filesz; i++) {
-        dest[i] = image[ph->p_offset + i];
-    }
-    for (uint32_t i = ph->p_filesz; i < ph->p_memsz; i++) {
-        dest[i] = 0;
+    } else if (!copy_segment(ph, image, seg_start, seg_end, flags)) {
+        return 0;
     }
 
     if (seg_start < prog->lowest) {
@@ -132,17 +251,31 @@ static int map_segment(const struct elf32_phdr *ph, const uint8_t *image, uint32
     return 1;
 }
 
+/*
+ * Reserve [USER_STACK_LIMIT, USER_STACK_TOP) for the stack, with an unmapped
+ * guard page below it. Processes get a stack area with only the top page
+ * mapped and fault the rest in; the boot demo has no fault path, so it gets
+ * the whole reservation.
+ */
 static int map_user_stack(struct user_program *prog) {
-    uintptr_t base = USER_STACK_TOP - USER_STACK_SIZE;
-    for (uintptr_t addr = base; addr < USER_STACK_TOP; addr += PAGE_SIZE) {
-        if (!map_page(addr, PAGE_USER | PAGE_WRITE)) {
+    uintptr_t base = prog->vmas ? USER_STACK_TOP - PAGE_SIZE : USER_STACK_LIMIT;
+    if (prog->vmas) {
+        struct vma area = {0};
+        area.start = USER_STACK_LIMIT;
+        area.end = USER_STACK_TOP;
+        area.prot = PAGE_USER | PAGE_WRITE;
+        area.kind = VMA_STACK;
+        if (!vma_insert(prog->vmas, &area)) {
             return 0;
         }
     }
+    if (!map_pages(base, USER_STACK_TOP, PAGE_USER | PAGE_WRITE)) {
+        return 0;
+    }
     prog->stack_top = USER_STACK_TOP;
     prog->stack_base = base;
-    if (base < prog->lowest) {
-        prog->lowest = base;
+    if (USER_STACK_LIMIT < prog->lowest) {
+        prog->lowest = USER_STACK_LIMIT;
     }
     if (USER_STACK_TOP > prog->highest) {
         prog->highest = USER_STACK_TOP;
@@ -150,9 +283,13 @@ static int map_user_stack(struct user_program *prog) {
     return 1;
 }
 
-static int load_elf_image(const uint8_t *image, uint32_t size, struct user_program *prog) {
+int userland_elf_valid(const uint8_t *image, uint32_t size) {
     const struct elf32_ehdr *ehdr = (const struct elf32_ehdr *)image;
     const uint8_t expected_magic[4] = {0x7F, 'E', 'L', 'F'};
+    if (!image || size < sizeof(*ehdr)) {
+        kprintf("userland: image too small for an ELF header\n");
+        return 0;
+    }
     for (int i = 0; i < 4; i++) {
         if (ehdr->e_ident[i] != expected_magic[i]) {
             kprintf("userland: invalid ELF magic\n");
@@ -164,6 +301,19 @@ static int load_elf_image(const uint8_t *image, uint32_t size, struct user_progr
         kprintf("userland: unsupported ELF header\n");
         return 0;
     }
+    if (ehdr->e_phoff > size ||
+        (uint32_t)ehdr->e_phnum * sizeof(struct elf32_phdr) > size - ehdr->e_phoff) {
+        kprintf("userland: program headers overrun image\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int load_elf_image(const uint8_t *image, uint32_t size, struct user_program *prog) {
+    if (!userland_elf_valid(image, size)) {
+        return 0;
+    }
+    const struct elf32_ehdr *ehdr = (const struct elf32_ehdr *)image;
 
     prog->entry = ehdr->e_entry;
     prog->lowest = (uintptr_t)-1;
@@ -256,6 +406,7 @@ int userland_run_demo(void) {
     struct user_program prog;
     int ok;
 
+    prog.vmas = NULL;
     const uint8_t *image = _binary_build_user_hello_user_elf_start;
     uint32_t size = (uint32_t)(uintptr_t)(_binary_build_user_hello_user_elf_end - _binary_build_user_hello_user_elf_start);
 
@@ -283,25 +434,118 @@ user_return:
     return user_state.exit_code;
 }
 
+/*
+ * Stage the first scheduled process. Only bench builds have one today: the
+ * fork benchmark, which exercises fork, copy-on-write, exit and waitpid.
+ */
 int userland_bootstrap_demo(void) {
+#ifdef CONFIG_BOOT_BENCH
+    const uint8_t *image = _binary_build_user_forkbench_elf_start;
+    uint32_t size = (uint32_t)(uintptr_t)(_binary_build_user_forkbench_elf_end - _binary_build_user_forkbench_elf_start);
+    process_init();
+    return process_spawn_from_image(image, size, "forkbench");
+#else
     return -1;
+#endif
 }
 
 void userland_finished(void) {
 }
 
+/*
+ * Load an ELF image into the user half of `directory`. Only the headers are
+ * read here: segments become file-backed areas in `out->vmas`, populated by
+ * userland_fill_page() on first touch, so `image` must outlive the process.
+ * The stack area gets its top page now, with the directory switched in. On
+ * failure the area map is freed, and whatever was mapped stays in
+ * `directory` for the caller's teardown.
+ */
 int userland_load_elf_into(const uint8_t *image, uint32_t size, uint32_t *directory, struct process_image *out) {
-    (void)image;
-    (void)size;
-    (void)directory;
-    (void)out;
-    return 0;
+    if (!directory || !out) {
+        return 0;
+    }
+
+    struct user_program prog;
+    vma_map_init(&out->vmas);
+    prog.vmas = &out->vmas;
+    uint32_t *previous = paging_current_directory();
+    paging_switch_directory(directory);
+    int ok = load_elf_image(image, size, &prog);
+    paging_switch_directory(previous);
+    if (!ok) {
+        vma_map_destroy(&out->vmas);
+        return 0;
+    }
+
+    out->entry = prog.entry;
+    out->stack_top = prog.stack_top;
+    out->brk_start = 0;
+    for (uint32_t i = 0; i < out->vmas.count; i++) {
+        if (out->vmas.areas[i].kind == VMA_FILE && out->vmas.areas[i].end > out->brk_start) {
+            out->brk_start = out->vmas.areas[i].end;
+        }
+    }
+    out->brk = out->brk_start;
+    return 1;
 }
 
-int userland_clone_region(uint32_t *src_directory, uint32_t *dst_directory, uintptr_t low, uintptr_t high) {
-    (void)src_directory;
-    (void)dst_directory;
-    (void)low;
-    (void)high;
-    return 0;
+/*
+ * Populate the user page at `page` of `area` in the current address space:
+ * a zeroed frame plus, for file areas, whatever file bytes fall in the page.
+ * A read of anonymous memory maps the shared zero frame instead, read-only
+ * (copy-on-write if the area is writable), so only written pages cost a frame.
+ */
+int userland_fill_page(const struct vma *area, uintptr_t page, int write) {
+    if (area->kind == VMA_SHARED) {
+        return 0; /* mapped whole when attached; a hole here is a bug */
+    }
+    if (area->kind == VMA_ANON && !write) {
+        phys_addr_t zero = paging_zero_page();
+        uint32_t flags = (area->prot & ~PAGE_WRITE) | ((area->prot & PAGE_WRITE) ? PAGE_COW : 0);
+        if (!zero || !paging_map(page, zero, flags)) {
+            return 0;
+        }
+        pmm_page_get(zero); /* the mapping's reference */
+        return 1;
+    }
+
+    phys_addr_t frame = user_frame(page, NULL);
+    if (!frame) {
+        kprintf("userland: no frame for page 0x%x\n", (uint32_t)page);
+        return 0;
+    }
+    for (uint32_t i = 0; area->kind == VMA_FILE && i < area->file_ranges; i++) {
+        const struct vma_file_range *range = &area->files[i];
+        uintptr_t from = range->vaddr > page ? range->vaddr : page;
+        uintptr_t to = range->vaddr + range->size;
+        if (to > page + PAGE_SIZE) {
+            to = page + PAGE_SIZE;
+        }
+        if (from < to) {
+            paging_copy_to_frame(frame, (uint32_t)(from - page),
+                                 area->file + range->offset + (from - range->vaddr), to - from);
+        }
+    }
+
+    if (!paging_map(page, frame, area->prot)) {
+        pmm_free_frame(frame);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Give `dst_directory` the pages of [low, high) from `src_directory` for fork.
+ * Nothing is copied up front: frames are shared copy-on-write and duplicated
+ * one page at a time by the page-fault handler. `shared` regions (shared
+ * memory) keep pointing at the same frames for writing on both sides.
+ */
+int userland_clone_region(uint32_t *src_directory, uint32_t *dst_directory, uintptr_t low, uintptr_t high,
+                          int shared) {
+    if (!src_directory || !dst_directory || low >= high) {
+        return 0;
+    }
+    uintptr_t start = align_down(low, PAGE_SIZE);
+    uintptr_t end = align_up(high, PAGE_SIZE);
+    return paging_share_range(src_directory, dst_directory, start, (end - start) / PAGE_SIZE, !shared);
 }
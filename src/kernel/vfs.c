@@ -3,12 +3,13 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "osmosis/kmalloc.h"
 #include "osmosis/kprintf.h"
 
-#define MAX_VFS_NODES 32
 #define NAME_MAX 96
 
-static struct vfs_node nodes[MAX_VFS_NODES];
+static struct kmem_cache *node_cache = NULL;
+static struct vfs_node *nodes = NULL; /* in initramfs order */
 static uint32_t node_count = 0;
 
 struct initramfs_entry {
@@ -16,8 +17,27 @@ struct initramfs_entry {
     uint32_t size;
 };
 
+/* Cache constructor: an empty node at the end of the list. */
+static void node_ctor(void *obj) {
+    struct vfs_node *node = obj;
+    node->path = NULL;
+    node->data = NULL;
+    node->size = 0;
+    node->next = NULL;
+}
+
 void vfs_init(const uint8_t *initramfs, uint32_t size) {
+    if (!node_cache) {
+        node_cache = kmem_cache_create("vfs_node", sizeof(struct vfs_node), 0, node_ctor);
+    }
+    while (nodes) {
+        struct vfs_node *next = nodes->next;
+        node_ctor(nodes);
+        kmem_cache_free(node_cache, nodes);
+        nodes = next;
+    }
     node_count = 0;
+    struct vfs_node **tail = &nodes;
     const uint8_t *cursor = initramfs;
     const uint8_t *end = initramfs + size;
     while (cursor + sizeof(struct initramfs_entry) <= end) {
@@ -26,17 +46,20 @@ void vfs_init(const uint8_t *initramfs, uint32_t size) {
         if (hdr->size == 0 || hdr->name[0] == 0) {
             break;
         }
-        if (node_count >= MAX_VFS_NODES) {
-            kprintf("vfs: initramfs truncated (capacity %u)\n", MAX_VFS_NODES);
-            break;
-        }
         if (cursor + hdr->size > end) {
             kprintf("vfs: entry %s truncated\n", hdr->name);
             break;
         }
-        nodes[node_count].path = (const char *)hdr->name;
-        nodes[node_count].data = cursor;
-        nodes[node_count].size = hdr->size;
+        struct vfs_node *node = kmem_cache_alloc(node_cache);
+        if (!node) {
+            kprintf("vfs: initramfs truncated (out of memory after %u files)\n", node_count);
+            break;
+        }
+        node->path = (const char *)hdr->name;
+        node->data = cursor;
+        node->size = hdr->size;
+        *tail = node;
+        tail = &node->next;
         node_count++;
         uint32_t aligned = (hdr->size + 3u) & ~3u;
         cursor += aligned;
@@ -48,8 +71,7 @@ const struct vfs_node *vfs_lookup(const char *path) {
     if (!path) {
         return NULL;
     }
-    for (uint32_t i = 0; i < node_count; i++) {
-        const struct vfs_node *n = &nodes[i];
+    for (const struct vfs_node *n = nodes; n; n = n->next) {
         const char *p = path;
         const char *q = n->path;
         int match = 1;
@@ -87,8 +109,7 @@ int vfs_read(const struct vfs_node *node, uint32_t offset, void *buf, uint32_t l
 }
 
 void vfs_list(void) {
-    for (uint32_t i = 0; i < node_count; i++) {
-        const struct vfs_node *n = &nodes[i];
+    for (const struct vfs_node *n = nodes; n; n = n->next) {
         kprintf("%s (%u bytes)\n", n->path, n->size);
     }
 }
@@ -0,0 +1,245 @@
+#include "osmosis/vma.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osmosis/arch/i386/paging.h"
+#include "osmosis/kmalloc.h"
+
+void vma_map_init(struct vma_map *map) {
+    map->count = 0;
+    map->capacity = 0;
+    map->areas = NULL;
+}
+
+void vma_map_destroy(struct vma_map *map) {
+    kfree(map->areas);
+    vma_map_init(map);
+}
+
+/* Make room for `extra` more areas, doubling the array. Returns 0 when memory is short. */
+static int reserve_slots(struct vma_map *map, uint32_t extra) {
+    if (map->count + extra <= map->capacity) {
+        return 1;
+    }
+    uint32_t capacity = map->capacity ? map->capacity : VMA_INITIAL_CAPACITY;
+    while (capacity < map->count + extra) {
+        capacity *= 2u;
+    }
+    struct vma *areas = kmalloc(capacity * sizeof(struct vma));
+    if (!areas) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < map->count; i++) {
+        areas[i] = map->areas[i];
+    }
+    kfree(map->areas);
+    map->areas = areas;
+    map->capacity = capacity;
+    return 1;
+}
+
+/* Copy `src` into the empty map `dst`, as fork does. Returns 0 when memory is short. */
+int vma_map_clone(struct vma_map *dst, const struct vma_map *src) {
+    if (!reserve_slots(dst, src->count)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < src->count; i++) {
+        dst->areas[i] = src->areas[i];
+    }
+    dst->count = src->count;
+    return 1;
+}
+
+/* Index of the first area that ends above `addr` (count if none does). */
+static uint32_t first_ending_above(const struct vma_map *map, uintptr_t addr) {
+    uint32_t lo = 0;
+    uint32_t hi = map->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2u;
+        if (map->areas[mid].end <= addr) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const struct vma *find_area(const struct vma_map *map, uintptr_t addr) {
+    uint32_t i = first_ending_above(map, addr);
+    if (i < map->count && map->areas[i].start <= addr) {
+        return &map->areas[i];
+    }
+    return NULL;
+}
+
+struct vma *vma_find(struct vma_map *map, uintptr_t addr) {
+    return (struct vma *)find_area(map, addr);
+}
+
+/* Whether `b` continues `a` so closely that the two can be one area. */
+static int can_merge(const struct vma *a, const struct vma *b) {
+    if (a->end != b->start || a->prot != b->prot || a->kind != b->kind || a->file != b->file ||
+        a->file_ranges != b->file_ranges) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < a->file_ranges; i++) {
+        if (a->files[i].vaddr != b->files[i].vaddr || a->files[i].offset != b->files[i].offset ||
+            a->files[i].size != b->files[i].size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void remove_slots(struct vma_map *map, uint32_t index, uint32_t n) {
+    for (uint32_t i = index; i + n < map->count; i++) {
+        map->areas[i] = map->areas[i + n];
+    }
+    map->count -= n;
+}
+
+/*
+ * Add an area that overlaps no existing one, merging it with either
+ * neighbour where possible. Returns 0 on overlap, bad bounds, or when the
+ * map cannot grow.
+ */
+int vma_insert(struct vma_map *map, const struct vma *area) {
+    if (area->start >= area->end || (area->start & (PAGE_SIZE - 1u)) ||
+        (area->end & (PAGE_SIZE - 1u))) {
+        return 0;
+    }
+    uint32_t i = first_ending_above(map, area->start);
+    if (i < map->count && map->areas[i].start < area->end) {
+        return 0; /* overlap */
+    }
+
+    if (i > 0 && can_merge(&map->areas[i - 1u], area)) {
+        map->areas[i - 1u].end = area->end;
+        if (i < map->count && can_merge(&map->areas[i - 1u], &map->areas[i])) {
+            map->areas[i - 1u].end = map->areas[i].end;
+            remove_slots(map, i, 1);
+        }
+        return 1;
+    }
+    if (i < map->count && can_merge(area, &map->areas[i])) {
+        map->areas[i].start = area->start;
+        return 1;
+    }
+
+    if (!reserve_slots(map, 1)) {
+        return 0;
+    }
+    for (uint32_t j = map->count; j > i; j--) {
+        map->areas[j] = map->areas[j - 1u];
+    }
+    map->areas[i] = *area;
+    map->count++;
+    return 1;
+}
+
+/*
+ * Make `addr` an area boundary by splitting the area that straddles it.
+ * Returns 0 only when a split is needed and the map cannot grow.
+ */
+int vma_split(struct vma_map *map, uintptr_t addr) {
+    addr &= ~(uintptr_t)(PAGE_SIZE - 1u);
+    uint32_t i = first_ending_above(map, addr);
+    if (i == map->count || map->areas[i].start >= addr) {
+        return 1; /* no area straddles addr */
+    }
+    if (!reserve_slots(map, 1)) {
+        return 0;
+    }
+    for (uint32_t j = map->count; j > i + 1u; j--) {
+        map->areas[j] = map->areas[j - 1u];
+    }
+    map->areas[i + 1u] = map->areas[i];
+    map->areas[i].end = addr;
+    map->areas[i + 1u].start = addr;
+    map->count++;
+    return 1;
+}
+
+/* Drop [start, end) from the map, splitting areas that reach past it. */
+int vma_remove(struct vma_map *map, uintptr_t start, uintptr_t end) {
+    if (start >= end || !vma_split(map, start) || !vma_split(map, end)) {
+        return 0;
+    }
+    uint32_t first = first_ending_above(map, start);
+    uint32_t last = first;
+    while (last < map->count && map->areas[last].start < end) {
+        last++;
+    }
+    remove_slots(map, first, last - first);
+    return 1;
+}
+
+/*
+ * The lowest address in [low, high) with `size` bytes free of areas, or 0.
+ * `low` and `size` must be page-aligned. The page below a stack area stays
+ * free as its guard.
+ */
+uintptr_t vma_find_gap(const struct vma_map *map, uintptr_t low, uintptr_t high, uint32_t size) {
+    uintptr_t candidate = low;
+    for (uint32_t i = first_ending_above(map, low); i < map->count; i++) {
+        const struct vma *area = &map->areas[i];
+        uintptr_t limit = area->start;
+        if (area->kind == VMA_STACK && limit >= PAGE_SIZE) {
+            limit -= PAGE_SIZE;
+        }
+        if (limit > high) {
+            limit = high;
+        }
+        if (candidate <= limit && limit - candidate >= size) {
+            return candidate;
+        }
+        if (area->end > candidate) {
+            candidate = area->end;
+        }
+        if (candidate >= high) {
+            return 0;
+        }
+    }
+    if (candidate < high && high - candidate >= size) {
+        return candidate;
+    }
+    return 0;
+}
+
+/* Whether [addr, addr + len) lies inside areas that all grant `prot`. */
+int vma_range_ok(const struct vma_map *map, uintptr_t addr, uint32_t len, uint32_t prot) {
+    if (len == 0) {
+        return 0;
+    }
+    uintptr_t last = addr + len - 1u;
+    if (last < addr) {
+        return 0;
+    }
+    for (;;) {
+        const struct vma *area = find_area(map, addr);
+        if (!area || (area->prot & prot) != prot) {
+            return 0;
+        }
+        if (last < area->end) {
+            return 1;
+        }
+        addr = area->end;
+    }
+}
+
+const char *vma_kind_name(enum vma_kind kind) {
+    switch (kind) {
+        case VMA_ANON:
+            return "anon";
+        case VMA_FILE:
+            return "file";
+        case VMA_STACK:
+            return "stack";
+        case VMA_SHARED:
+            return "shared";
+        default:
+            return "?";
+    }
+}
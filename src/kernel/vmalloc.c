@@ -0,0 +1,205 @@
+#include "osmosis/vmalloc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osmosis/arch/i386/paging.h"
+#include "osmosis/kprintf.h"
+#include "osmosis/pmm.h"
+
+#define PF_PRESENT 0x1u
+#define PF_USER 0x4u
+
+/*
+ * Virtually contiguous kernel buffers backed by frames from anywhere in the
+ * PMM. Each allocation is an area of the vmalloc window followed by one
+ * page that is never mapped, so running off the end faults instead of
+ * corrupting the next area. Areas are kept sorted by address.
+ */
+struct vmalloc_area {
+    uintptr_t start;
+    uint32_t pages;
+    uint32_t mapped;
+    int lazy; /* pages are populated on first touch */
+};
+
+static struct vmalloc_area areas[VMALLOC_MAX_AREAS];
+static uint32_t area_count = 0;
+static int ready = 0;
+static uint32_t lazy_faults = 0;
+static uint32_t failures = 0;
+
+static phys_addr_t vmalloc_frame(uintptr_t virt, void *ctx) {
+    (void)ctx;
+    return pmm_alloc_frame_color(virt, PMM_ALLOC_ZERO);
+}
+
+static void release_vmalloc_frame(uintptr_t virt, phys_addr_t phys, void *ctx) {
+    (void)virt;
+    (void)ctx;
+    pmm_free_frame(phys);
+}
+
+/* The window's page tables are shared by every address space, so create them now. */
+void vmalloc_init(void) {
+    ready = paging_reserve_kernel_tables(PAGING_VMALLOC_BASE,
+                                         PAGING_VMALLOC_LIMIT - PAGING_VMALLOC_BASE);
+    if (!ready) {
+        kprintf("vmalloc: failed to reserve page tables\n");
+    }
+}
+
+/* Index of the first area that ends above `addr` (area_count if none does). */
+static uint32_t first_ending_above(uintptr_t addr) {
+    uint32_t lo = 0;
+    uint32_t hi = area_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2u;
+        if (areas[mid].start + areas[mid].pages * PAGE_SIZE <= addr) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static struct vmalloc_area *find_area(uintptr_t addr) {
+    uint32_t i = first_ending_above(addr);
+    if (i < area_count && areas[i].start <= addr) {
+        return &areas[i];
+    }
+    return NULL;
+}
+
+/* First fit: the lowest gap that holds the area and its guard page. */
+static struct vmalloc_area *reserve(uint32_t pages, int lazy) {
+    if (!ready || !pages || area_count == VMALLOC_MAX_AREAS ||
+        pages >= (PAGING_VMALLOC_LIMIT - PAGING_VMALLOC_BASE) / PAGE_SIZE) {
+        return NULL;
+    }
+    uintptr_t span = (pages + 1u) * PAGE_SIZE;
+    uintptr_t start = PAGING_VMALLOC_BASE;
+    uint32_t index = 0;
+    while (index < area_count && areas[index].start - start < span) {
+        start = areas[index].start + (areas[index].pages + 1u) * PAGE_SIZE;
+        index++;
+    }
+    if (start > PAGING_VMALLOC_LIMIT - span) {
+        return NULL;
+    }
+
+    for (uint32_t i = area_count; i > index; i--) {
+        areas[i] = areas[i - 1u];
+    }
+    area_count++;
+    struct vmalloc_area *area = &areas[index];
+    area->start = start;
+    area->pages = pages;
+    area->mapped = 0;
+    area->lazy = lazy;
+    return area;
+}
+
+static void release(struct vmalloc_area *area) {
+    paging_unmap_range(paging_kernel_directory(), area->start, area->pages,
+                       release_vmalloc_frame, NULL);
+    for (uint32_t i = (uint32_t)(area - areas); i + 1u < area_count; i++) {
+        areas[i] = areas[i + 1u];
+    }
+    area_count--;
+}
+
+static uint32_t pages_for(size_t size) {
+    return (uint32_t)((size + PAGE_SIZE - 1u) / PAGE_SIZE);
+}
+
+/* Allocate `size` bytes of zeroed, page-aligned memory, backed right away. */
+void *vmalloc(size_t size) {
+    struct vmalloc_area *area = reserve(pages_for(size), 0);
+    if (!area) {
+        failures++;
+        return NULL;
+    }
+    area->mapped = (uint32_t)paging_map_range(paging_kernel_directory(), area->start,
+                                              area->pages, PAGE_WRITE, vmalloc_frame, NULL);
+    if (area->mapped != area->pages) {
+        release(area);
+        failures++;
+        return NULL;
+    }
+    return (void *)area->start;
+}
+
+/*
+ * Reserve `size` bytes whose pages get a zeroed frame when first touched.
+ * Suits large tables that are mostly unused; touching a page can then fail
+ * for lack of memory, which panics like any other bad kernel fault.
+ */
+void *vmalloc_lazy(size_t size) {
+    struct vmalloc_area *area = reserve(pages_for(size), 1);
+    if (!area) {
+        failures++;
+        return NULL;
+    }
+    return (void *)area->start;
+}
+
+/* Unmap an area and free its frames. `addr` must be what vmalloc returned. */
+void vfree(void *addr) {
+    if (!addr) {
+        return;
+    }
+    struct vmalloc_area *area = find_area((uintptr_t)addr);
+    if (!area || area->start != (uintptr_t)addr) {
+        kprintf("vfree: 0x%x was not allocated\n", (uint32_t)(uintptr_t)addr);
+        return;
+    }
+    release(area);
+}
+
+/* Page-fault hook: populate a page of a lazy area the kernel touched. */
+int vmalloc_fault(uintptr_t addr, uint32_t error) {
+    if (addr < PAGING_VMALLOC_BASE || addr >= PAGING_VMALLOC_LIMIT ||
+        (error & (PF_PRESENT | PF_USER))) {
+        return 0;
+    }
+    struct vmalloc_area *area = find_area(addr);
+    if (!area || !area->lazy) {
+        return 0;
+    }
+    uintptr_t page = addr & ~(uintptr_t)(PAGE_SIZE - 1u);
+    if (paging_map_range(paging_kernel_directory(), page, 1, PAGE_WRITE, vmalloc_frame,
+                         NULL) != 1) {
+        kprintf("vmalloc: no frame for 0x%x\n", (uint32_t)page);
+        failures++;
+        return 0;
+    }
+    area->mapped++;
+    lazy_faults++;
+    return 1;
+}
+
+void vmalloc_list(void) {
+    kprintf("START       PAGES  MAPPED  LAZY\n");
+    for (uint32_t i = 0; i < area_count; i++) {
+        const struct vmalloc_area *area = &areas[i];
+        kprintf("0x%08x  %5u  %6u  %s\n", (uint32_t)area->start, area->pages, area->mapped,
+                area->lazy ? "yes" : "no");
+    }
+    kprintf("lazy faults=%u failures=%u\n", lazy_faults, failures);
+}
+
+struct vmalloc_stats vmalloc_get_stats(void) {
+    struct vmalloc_stats stats;
+    stats.areas = area_count;
+    stats.reserved_pages = 0;
+    stats.mapped_pages = 0;
+    for (uint32_t i = 0; i < area_count; i++) {
+        stats.reserved_pages += areas[i].pages;
+        stats.mapped_pages += areas[i].mapped;
+    }
+    stats.lazy_faults = lazy_faults;
+    stats.failures = failures;
+    return stats;
+}
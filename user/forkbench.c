@@ -0,0 +1,108 @@
+#include <stdint.h>
+
+#include "osmosis/syscall_numbers.h"
+
+#define ROUNDS 32u
+
+static inline int32_t syscall0(uint32_t num) {
+    int32_t ret;
+    __asm__ __volatile__("int $0x80" : "=a"(ret) : "a"(num) : "memory");
+    return ret;
+}
+
+static inline int32_t syscall1(uint32_t num, uint32_t arg1) {
+    int32_t ret;
+    __asm__ __volatile__("int $0x80"
+                         : "=a"(ret)
+                         : "a"(num), "b"(arg1)
+                         : "memory");
+    return ret;
+}
+
+static inline int32_t syscall3(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    int32_t ret;
+    __asm__ __volatile__("int $0x80"
+                         : "=a"(ret)
+                         : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3)
+                         : "memory");
+    return ret;
+}
+
+/* Low half of the TSC; one round stays far below 2^32 cycles. */
+static inline uint32_t rdtsc32(void) {
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    (void)hi;
+    return lo;
+}
+
+static void put(const char *s) {
+    uint32_t len = 0;
+    while (s[len]) {
+        len++;
+    }
+    (void)syscall3(OSMOSIS_SYS_WRITE, 1, (uint32_t)(uintptr_t)s, len);
+}
+
+static void put_u32(uint32_t value) {
+    char buf[11];
+    int pos = 10;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = (char)('0' + value % 10u);
+        value /= 10u;
+    } while (value);
+    put(&buf[pos]);
+}
+
+/*
+ * Fork a child that exits at once and wait for it, ROUNDS times, and report
+ * the cycles per round. With `touch` set the child first writes to its
+ * stack page, adding a copy-on-write fault to every round.
+ */
+static int measure(const char *label, int touch) {
+    volatile uint32_t scratch = 0;
+    uint32_t total = 0;
+    uint32_t best = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < ROUNDS; i++) {
+        uint32_t start = rdtsc32();
+        int32_t pid = syscall0(OSMOSIS_SYS_FORK);
+        if (pid == 0) {
+            if (touch) {
+                scratch = i;
+            }
+            syscall1(OSMOSIS_SYS_EXIT, 0);
+        }
+        if (pid < 0) {
+            put("forkbench: fork failed\n");
+            return 0;
+        }
+        if (syscall1(OSMOSIS_SYS_WAITPID, (uint32_t)pid) != pid) {
+            put("forkbench: waitpid failed\n");
+            return 0;
+        }
+        uint32_t cycles = rdtsc32() - start;
+        total += cycles;
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    (void)scratch;
+
+    put("forkbench: ");
+    put(label);
+    put(" avg=");
+    put_u32(total / ROUNDS);
+    put(" best=");
+    put_u32(best);
+    put(" cycles\n");
+    return 1;
+}
+
+void _start(void) {
+    int ok = measure("fork+exit", 0) && measure("fork+write+exit", 1);
+    syscall1(OSMOSIS_SYS_EXIT, ok ? 0 : 1);
+    for (;;)
+        ;
+}